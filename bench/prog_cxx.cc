@@ -0,0 +1,32 @@
+// for syscall() in this tree's unistd.h
+#define __BSD_VISIBLE 1
+
+#include <linux/time.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ * prog.c, with what startup costs a C++ program on top: a static object,
+ * constructed from the init array, with a destructor registered with
+ * __cxa_atexit(). It needs no C++ runtime, so it is built without exceptions
+ * or RTTI.
+ */
+struct object {
+  volatile int state;
+
+  object() { state = 1; }
+  ~object() { state = 2; }
+};
+
+static object obj;
+
+int main() {
+  struct __kernel_timespec ts;
+  syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+  unsigned long long ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  // a program whose constructors haven't run reports nothing, and fails
+  if (obj.state != 1)
+    return 1;
+  syscall(SYS_write, 3, &ns, sizeof(ns));
+  return 0;
+}
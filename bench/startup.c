@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Startup latency. Each program given is run over and over, and timed from
+ * just before posix_spawn() to its main(), which writes CLOCK_MONOTONIC to
+ * file descriptor 3 (see prog.c), and to its exit being seen by waitpid().
+ * The median and 99th percentile of both are reported, in microseconds.
+ *
+ * This is built for, and runs on, the host; only the programs it runs use
+ * the libraries in this tree.
+ */
+
+extern char **environ;
+
+static unsigned long long monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b) {
+  unsigned long long x = *(const unsigned long long *)a;
+  unsigned long long y = *(const unsigned long long *)b;
+  return x < y ? -1 : x > y;
+}
+
+// the pth percentile of n sorted times, in microseconds
+static double percentile(const unsigned long long *t, size_t n, int p) {
+  return t[(n - 1) * p / 100] / 1000.0;
+}
+
+// runs path once, leaving its times in main_ns and exit_ns
+static int run(const char *path, unsigned long long *main_ns,
+               unsigned long long *exit_ns) {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    perror("pipe2");
+    return -1;
+  }
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], 3);
+
+  char *argv[] = {(char *)path, 0};
+  pid_t pid;
+  unsigned long long start = monotonic_ns();
+  int err = posix_spawn(&pid, path, &actions, 0, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[1]);
+  if (err != 0) {
+    fprintf(stderr, "%s: %s\n", path, strerror(err));
+    close(fds[0]);
+    return -1;
+  }
+
+  unsigned long long reached = 0;
+  ssize_t n;
+  while ((n = read(fds[0], &reached, sizeof(reached))) < 0 && errno == EINTR)
+    ;
+  int status;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    ;
+  unsigned long long end = monotonic_ns();
+  close(fds[0]);
+
+  if (n != sizeof(reached) || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s: didn't report reaching main() and exit cleanly\n",
+            path);
+    return -1;
+  }
+  *main_ns = reached - start;
+  *exit_ns = end - start;
+  return 0;
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: startup [-n runs] [-w warmup runs] program ...\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  size_t runs = 5000, warmup = 100;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:w:")) != -1) {
+    switch (opt) {
+    case 'n':
+      runs = strtoul(optarg, 0, 10);
+      break;
+    case 'w':
+      warmup = strtoul(optarg, 0, 10);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind == argc || runs == 0)
+    usage();
+
+  unsigned long long *main_ns = malloc(runs * sizeof(*main_ns));
+  unsigned long long *exit_ns = malloc(runs * sizeof(*exit_ns));
+  if (main_ns == 0 || exit_ns == 0) {
+    perror("malloc");
+    return 1;
+  }
+
+  printf("%-32s %21s %21s\n", "", "exec to main (us)", "exec to exit (us)");
+  printf("%-32s %10s %10s %10s %10s\n", "program", "p50", "p99", "p50", "p99");
+  int failed = 0;
+  for (int i = optind; i < argc; i++) {
+    const char *path = argv[i];
+    // the first runs fault the program and its libraries into the page cache
+    unsigned long long m, e;
+    size_t done = 0;
+    for (size_t j = 0; j < warmup && run(path, &m, &e) == 0; j++)
+      ;
+    for (; done < runs; done++)
+      if (run(path, &main_ns[done], &exit_ns[done]) != 0)
+        break;
+    if (done < runs) {
+      failed = 1;
+      continue;
+    }
+
+    qsort(main_ns, runs, sizeof(*main_ns), compare);
+    qsort(exit_ns, runs, sizeof(*exit_ns), compare);
+    printf("%-32s %10.1f %10.1f %10.1f %10.1f\n", path,
+           percentile(main_ns, runs, 50), percentile(main_ns, runs, 99),
+           percentile(exit_ns, runs, 50), percentile(exit_ns, runs, 99));
+    fflush(stdout);
+  }
+  return failed;
+}
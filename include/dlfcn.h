@@ -12,15 +12,25 @@
  */
 #include <sys/cdefs.h>
 
-#define RTLD_LAZY 0
-#define RTLD_NOW 1
-#define RTLD_GLOBAL 2
-#define RTLD_LOCAL 3
+#define RTLD_LAZY 0x1
+#define RTLD_NOW 0x2
+#define RTLD_NOLOAD 0x4
+#define RTLD_LOCAL 0
+#define RTLD_GLOBAL 0x100
+#define RTLD_NODELETE 0x1000
+
+#if defined(__GNU_VISIBLE) || defined (__BSD_VISIBLE)
+#define RTLD_DEFAULT ((void *)0)
+#define RTLD_NEXT ((void *)-1)
+
+// dlinfo requests
+#define RTLD_DI_LINKMAP 2
+#endif
 
 __BEGIN_DECLS
 int dlclose(void *);
 char *dlerror(void);
-void *dlopen(void);
+void *dlopen(const char *, int);
 void *dlsym(void *__restrict, const char *__restrict);
 #if defined(__GNU_VISIBLE) || defined (__BSD_VISIBLE)
 int dlinfo(void *__restrict, int, void *__restrict);
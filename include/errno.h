@@ -9,7 +9,7 @@ extern
     "C"
 #endif
     int *
-    __errno_location(void) __noexcept;
+    __errno_location(void) __noexcept __pure2;
 
 #define errno (*__errno_location())
 
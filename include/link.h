@@ -2,6 +2,7 @@
 #define _LINK_H
 
 #include <elf.h>
+#include <sys/cdefs.h>
 #include <sys/types.h>
 /*
  * Linked list of dynamically linked objects in program's memory.
@@ -37,4 +38,9 @@ struct dl_phdr_info {
   void *dlpi_tls_data;
 };
 
+__BEGIN_DECLS
+int dl_iterate_phdr(
+    int (*)(struct dl_phdr_info *, size_t, void *), void *);
+__END_DECLS
+
 #endif
@@ -11,13 +11,15 @@
 # the actual location of the defines.
 ASM_UNISTD_H=$PWD/asm/unistd_64.h
 SYS_SYSCALL_H=$PWD/sys/syscall.h
+# the names libc's syscall statistics print, see lib/libc/sysstat.c
+SYSCALL_NAMES_H=$PWD/../lib/libc/private/syscall_names.h
 
 if [ ! -f "$ASM_UNISTD_H" ]; then
     echo "ERROR: $ASM_UNISTD_H not found. Please install kernel headers first."
     exit 1
 fi
-# remove the existing generated header if present
-rm -f "$SYS_SYSCALL_H"
+# remove the existing generated headers if present
+rm -f "$SYS_SYSCALL_H" "$SYSCALL_NAMES_H"
 
 write() {
     echo "$1">> "$SYS_SYSCALL_H"
@@ -31,6 +33,13 @@ write ""
 write "#include <linux/unistd.h>"
 write ""
 
+write_name() {
+    echo "$1">> "$SYSCALL_NAMES_H"
+}
+
+write_name "/* Generated via script. DO NOT MODIFY */"
+write_name "/* Entries of a table indexed by syscall number, see sys.syscall.h.sh */"
+
 while IFS= read -r LINE; do
     if [[ "$LINE" =~ ^#define[[:space:]]+__NR_[a-zA-Z0-9_]+ ]]; then
         SYMBOL=$(echo "$LINE" | awk '{print $2}')
@@ -39,6 +48,10 @@ while IFS= read -r LINE; do
         write "#define SYS_${SYMBOL#__NR_} $SYMBOL"
         write "#endif"
         write ""
+
+        write_name "#ifdef $SYMBOL"
+        write_name "[$SYMBOL] = \"${SYMBOL#__NR_}\","
+        write_name "#endif"
     fi
 done < "$ASM_UNISTD_H"
 
@@ -0,0 +1,31 @@
+#ifndef _SYS_RSEQ_H
+#define _SYS_RSEQ_H
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*
+ * Restartable sequences. The dynamic linker registers an area with the kernel
+ * for every thread, and these helpers update per-CPU data through it without
+ * atomic instructions: if the thread is preempted, migrated or interrupted by
+ * a signal before the final store, the sequence starts over.
+ *
+ * Per-CPU data is an array of slots, one per possible CPU, stride bytes apart;
+ * a cache line apart keeps CPUs off each other's lines. A free list slot holds
+ * its first node, and a node's first word points to the next one. Each slot
+ * must only ever be changed through these helpers.
+ */
+
+// the signature preceding every abort handler, given at registration
+#define RSEQ_SIG 0x53053053
+
+__BEGIN_DECLS
+// adds to this CPU's counter, and returns the CPU
+extern int rseq_percpu_add(void *, size_t, long) __noexcept;
+// pushes onto this CPU's list, and returns the CPU, or -1 without rseq
+extern int rseq_percpu_push(void *, size_t, void *) __noexcept;
+// pops from this CPU's list, or returns NULL if it is empty or without rseq
+extern void *rseq_percpu_pop(void *, size_t) __noexcept;
+__END_DECLS
+
+#endif /* _SYS_RSEQ_H */
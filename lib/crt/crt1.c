@@ -6,9 +6,23 @@ int main(int, char **, char **);
  * compatibility is better than none.
  */
 [[noreturn]] extern void __libc_start_main(int (*)(int, char **, char **), int,
-                                           char **);
+                                           char **, void (*)(void));
 
-void _start() {
-  register volatile long *sp __asm__("sp");
-  __libc_start_main(main, sp[0], (char **)sp + 1);
+/*
+ * argc is where the kernel left the stack pointer, which a C function can't
+ * see past its own frame, so _start passes it on, with the function the
+ * dynamic linker left in rdx for atexit(), and realigns the stack for the call.
+ */
+__asm__(".text\n"
+        ".global _start\n"
+        "_start:\n"
+        "  xor %ebp, %ebp\n"
+        "  mov %rsp, %rdi\n"
+        "  mov %rdx, %rsi\n"
+        "  and $-16, %rsp\n"
+        "  call _start_c\n");
+
+__attribute__((visibility("hidden"), used)) void _start_c(long *sp,
+                                                         void (*fini)(void)) {
+  __libc_start_main(main, sp[0], (char **)sp + 1, fini);
 }
\ No newline at end of file
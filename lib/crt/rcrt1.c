@@ -0,0 +1,87 @@
+#include <elf.h>
+
+int main(int, char **, char **);
+[[noreturn]] extern void __libc_start_main(int (*)(int, char **, char **), int,
+                                           char **, void (*)(void));
+
+/*
+ * Startup for static PIE programs, which nothing relocates: they are loaded
+ * anywhere, without an interpreter, so this applies their relocations itself
+ * before calling anything: RELATIVE ones, which are all a static PIE should
+ * have besides IRELATIVE, then IRELATIVE ones, whose resolvers run before the
+ * thread pointer is set up. Nothing here may load an address that needs
+ * relocating, so everything is found PC-relative.
+ */
+
+extern const Elf64_Dyn _DYNAMIC[] __attribute__((visibility("hidden")));
+// the ELF header, at the load address, as the first segment maps from zero
+extern const Elf64_Ehdr __ehdr_start __attribute__((visibility("hidden")));
+
+static void relocate(void) {
+  unsigned long base = (unsigned long)&__ehdr_start;
+
+  const Elf64_Rela *rela = 0;
+  const Elf64_Relr *relr = 0;
+  unsigned long relasz = 0, relaent = sizeof(Elf64_Rela), relrsz = 0;
+  for (const Elf64_Dyn *dyn = _DYNAMIC; dyn->d_tag != DT_NULL; dyn++) {
+    switch (dyn->d_tag) {
+    case DT_RELA:
+      rela = (const Elf64_Rela *)(base + dyn->d_un.d_ptr);
+      break;
+    case DT_RELASZ:
+      relasz = dyn->d_un.d_val;
+      break;
+    case DT_RELAENT:
+      relaent = dyn->d_un.d_val;
+      break;
+    case DT_RELR:
+      relr = (const Elf64_Relr *)(base + dyn->d_un.d_ptr);
+      break;
+    case DT_RELRSZ:
+      relrsz = dyn->d_un.d_val;
+      break;
+    }
+  }
+
+  for (unsigned long i = 0; i < relasz / relaent; i++)
+    if (ELF64_R_TYPE(rela[i].r_info) == R_X86_64_RELATIVE)
+      *(unsigned long *)(base + rela[i].r_offset) = base + rela[i].r_addend;
+
+  // addresses followed by bitmaps of the words after them, as in rtld
+  unsigned long *where = 0;
+  for (unsigned long i = 0; i < relrsz / sizeof(Elf64_Relr); i++) {
+    Elf64_Relr entry = relr[i];
+    if ((entry & 1) == 0) {
+      where = (unsigned long *)(base + entry);
+      *where++ += base;
+    } else {
+      for (unsigned long *p = where; (entry >>= 1) != 0; p++)
+        if (entry & 1)
+          *p += base;
+      where += 8 * sizeof(Elf64_Relr) - 1;
+    }
+  }
+
+  for (unsigned long i = 0; i < relasz / relaent; i++)
+    if (ELF64_R_TYPE(rela[i].r_info) == R_X86_64_IRELATIVE) {
+      unsigned long (*resolver)(void) =
+          (unsigned long (*)(void))(base + rela[i].r_addend);
+      *(unsigned long *)(base + rela[i].r_offset) = resolver();
+    }
+}
+
+// as in crt1.c
+__asm__(".text\n"
+        ".global _start\n"
+        "_start:\n"
+        "  xor %ebp, %ebp\n"
+        "  mov %rsp, %rdi\n"
+        "  mov %rdx, %rsi\n"
+        "  and $-16, %rsp\n"
+        "  call _start_c\n");
+
+__attribute__((visibility("hidden"), used)) void _start_c(long *sp,
+                                                         void (*fini)(void)) {
+  relocate();
+  __libc_start_main(main, sp[0], (char **)sp + 1, fini);
+}
@@ -8,15 +8,18 @@ const char *__progname;
 
 extern char **environ;
 extern const Elf64_auxv_t *_auxv;
+// defined by the dynamic linker, so missing from static programs
+extern void *_rtld_allocate_tls(void) __attribute__((weak));
+void __libc_init_static(int, char **, char **);
 
 void handle_argv(int argc, char **argv) {
-  char **env = argv + argc;
+  char **env = argv + argc + 1;
   if (!environ)
     environ = env;
 
   char **auxv = env;
-  while (*++auxv != 0)
-    ;
+  while (*auxv != 0)
+    auxv++;
   _auxv = (const Elf64_auxv_t *)++auxv;
 
   __progname =
@@ -26,8 +29,22 @@ void handle_argv(int argc, char **argv) {
       __progname = s + 1;
 }
 
-__exported noreturn void
-__libc_start_main(int (*main)(int, char **, char **), int argc, char **argv) {
+/*
+ * rtld_fini is what the dynamic linker left in rdx for _start, which runs
+ * every object's finalizers. It is registered after every object's
+ * constructors have run, so exit() reaches it before the __cxa_atexit()
+ * handlers those registered; rtld_fini runs them itself, calling
+ * __cxa_finalize() for each object just before its finalizers, in dependency
+ * order. Handlers main() registers run before any of that. Static programs
+ * run their own initializers and finalizers.
+ */
+__exported noreturn void __libc_start_main(
+    int (*main)(int, char **, char **), int argc, char **argv,
+    void (*rtld_fini)(void)) {
   handle_argv(argc, argv);
+  if (_rtld_allocate_tls == 0)
+    __libc_init_static(argc, argv, environ);
+  else if (rtld_fini != 0)
+    atexit(rtld_fini);
   exit(main(argc, argv, environ));
 }
@@ -0,0 +1,157 @@
+#include <link.h>
+#include <linux/mman.h>
+#include <stdlib.h>
+#include <sys/cdefs.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "syscall.h"
+
+/*
+ * Functions registered with atexit() and __cxa_atexit(), which C++ uses for
+ * every static destructor, so there can be tens of thousands. They are kept
+ * in chunks of CHUNK_SIZE, newest chunk first. Registering takes a slot with
+ * one atomic add on the newest chunk's count, and only a full chunk costs an
+ * mmap(); threads that race to replace it keep whichever chunk wins.
+ *
+ * A handler is run at most once: whoever runs it swaps its function out
+ * first. exit() runs all of them, newest first, and __cxa_finalize(dso) runs
+ * those belonging to one shared object as it is unloaded. A handler that
+ * registers another makes the walk start over, so the new one runs next.
+ */
+
+#define CHUNK_SIZE 1024
+
+struct handler {
+  void (*fn)(void *);
+  void *arg;
+  // the __dso_handle of the object that registered it, or 0
+  void *dso;
+};
+
+struct chunk {
+  struct chunk *next;
+  // slots handed out, which overshoots CHUNK_SIZE once it is full
+  unsigned long count;
+  struct handler handlers[CHUNK_SIZE];
+};
+
+static struct chunk first;
+static struct chunk *head = &first;
+// bumped by every registration, so a walk sees handlers added meanwhile
+static unsigned long registered;
+
+int __cxa_atexit(void (*fn)(void *), void *arg, void *dso) {
+  for (;;) {
+    struct chunk *c = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    unsigned long i = __atomic_fetch_add(&c->count, 1, __ATOMIC_RELAXED);
+    if (i < CHUNK_SIZE) {
+      c->handlers[i].arg = arg;
+      c->handlers[i].dso = dso;
+      __atomic_store_n(&c->handlers[i].fn, fn, __ATOMIC_RELEASE);
+      __atomic_fetch_add(&registered, 1, __ATOMIC_RELEASE);
+      return 0;
+    }
+
+    unsigned long addr =
+        __raw_syscall(SYS_mmap, 0, sizeof(struct chunk),
+                      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                      0);
+    if (addr > -4096UL)
+      return -1;
+    struct chunk *n = (struct chunk *)addr;
+    n->next = c;
+    if (!__atomic_compare_exchange_n(
+            &head, &c, n, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      __raw_syscall(SYS_munmap, n, sizeof(struct chunk));
+  }
+}
+__libc_hidden_def(__cxa_atexit);
+
+// a function taking nothing ignores the argument it is called with
+int atexit(void (*fn)(void)) {
+  return __cxa_atexit((void (*)(void *))fn, 0, 0);
+}
+__libc_hidden_def(atexit);
+
+// the loaded segments of the object holding an address
+struct object {
+  const void *addr;
+  unsigned long base;
+  const Elf64_Phdr *phdr;
+  size_t phnum;
+};
+
+static int in_object(const struct object *obj, const void *p) {
+  unsigned long addr = (unsigned long)p;
+  for (size_t i = 0; i < obj->phnum; i++) {
+    const Elf64_Phdr *ph = &obj->phdr[i];
+    unsigned long start = obj->base + ph->p_vaddr;
+    if (ph->p_type == PT_LOAD && addr >= start && addr - start < ph->p_memsz)
+      return 1;
+  }
+  return 0;
+}
+
+static int find_object(struct dl_phdr_info *info, size_t size, void *data) {
+  struct object *obj = data;
+  struct object candidate = {
+      obj->addr, info->dlpi_addr, info->dlpi_phdr, info->dlpi_phnum};
+  if (!in_object(&candidate, obj->addr))
+    return 0;
+  *obj = candidate;
+  return 1;
+}
+
+// the dynamic linker's, missing from static programs
+extern int dl_iterate_phdr(
+    int (*)(struct dl_phdr_info *, size_t, void *), void *)
+    __attribute__((weak));
+
+/*
+ * Runs the handlers registered from the object holding dso, or all of them
+ * for a null dso. The dynamic linker calls this as it unloads an object, with
+ * an address inside it, so handlers registered with a dso of 0 (atexit()) or
+ * some other one still run if their function is in the object.
+ */
+void __cxa_finalize(void *dso) {
+  struct object obj = {dso, 0, 0, 0};
+  if (dso != 0 && dl_iterate_phdr != 0)
+    dl_iterate_phdr(find_object, &obj);
+
+restart:;
+  unsigned long seen = __atomic_load_n(&registered, __ATOMIC_ACQUIRE);
+  for (struct chunk *c = __atomic_load_n(&head, __ATOMIC_ACQUIRE); c != 0;
+       c = c->next) {
+    unsigned long n = __atomic_load_n(&c->count, __ATOMIC_ACQUIRE);
+    for (unsigned long i = n < CHUNK_SIZE ? n : CHUNK_SIZE; i != 0; i--) {
+      struct handler *h = &c->handlers[i - 1];
+      void (*fn)(void *) = __atomic_load_n(&h->fn, __ATOMIC_ACQUIRE);
+      if (fn == 0)
+        continue;
+      if (dso != 0 && h->dso != dso && !in_object(&obj, h->dso) &&
+          !in_object(&obj, (const void *)fn))
+        continue;
+      if (!__atomic_compare_exchange_n(
+              &h->fn, &fn, 0, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        continue;
+
+      fn(h->arg);
+      if (__atomic_load_n(&registered, __ATOMIC_ACQUIRE) != seen)
+        goto restart;
+    }
+  }
+}
+__libc_hidden_def(__cxa_finalize);
+
+_Noreturn void exit(int status) {
+  __cxa_finalize(0);
+  _Exit(status);
+}
+__libc_hidden_def(exit);
+
+_Noreturn void _Exit(int status) {
+  for (;;)
+    __raw_syscall(SYS_exit_group, status);
+}
+__libc_hidden_def(_Exit);
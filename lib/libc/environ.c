@@ -1,9 +1,14 @@
 #include <errno.h>
-#include <malloc.h>
+#include <linux/mman.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
-char **environ;
+#include "syscall.h"
+
+__exported char **environ;
 
 /*
  * A rule about environ:
@@ -18,20 +23,204 @@ char **environ;
  * Don't be that person.
  */
 
-char *getenv(const char *name) {
-  for (size_t i = 0; environ[i]; i++) {
-    char *e = environ[i];
-    for (size_t c = 0;; c++) {
-      if (e[c] != name[c])
+/*
+ * getenv() looks names up in a hash index of environ, built the first time
+ * it is called and rebuilt whenever environ has changed under it. setenv()
+ * and putenv() keep the index up to date as they go, unsetenv() drops it.
+ * A program's own changes are noticed when it points environ elsewhere, or
+ * changes its first entry or empties one the index found, which covers
+ * clearing it with environ[0] = NULL. Other edits to environ's elements are
+ * not seen until the index is next rebuilt.
+ *
+ * The first change copies environ, and the array grows by doubling from then
+ * on. The strings setenv() makes come from an arena, with those it replaces
+ * kept for reuse, so a program setting the same variables over and over
+ * doesn't keep asking for memory. Strings that came from the kernel or
+ * putenv() are never written to.
+ *
+ * getenv() can be called from any number of threads at once, but, as
+ * elsewhere, not while another changes the environment.
+ */
+
+#define ARENA_SIZE 0x10000
+#define MIN_ENTRIES 32
+#define MIN_SLOTS 16
+
+struct slot {
+  uint32_t hash;
+  // position in environ plus one, or 0 for an empty slot
+  uint32_t pos;
+};
+
+struct index {
+  // the environ it was built for, and its first entry then
+  char **environ;
+  char *first;
+  size_t size, count, mask;
+  struct slot slots[];
+};
+
+// a string setenv() made, with room for capacity bytes
+struct string {
+  struct string *next_free;
+  size_t capacity;
+  char s[];
+};
+
+static struct index *env_index;
+static int index_lock;
+
+// the array environ points at once it has been copied, and the string made
+// for each of its entries, if any
+static char **entries;
+static struct string **strings;
+static size_t entry_count, entry_capacity;
+
+static char *arena;
+static size_t arena_left;
+static struct string *free_strings;
+
+static void *map(size_t size) {
+  unsigned long addr =
+      __raw_syscall(SYS_mmap, 0, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return addr > -4096UL ? 0 : (void *)addr;
+}
+
+static void unmap(void *p, size_t size) {
+  if (p != 0)
+    __raw_syscall(SYS_munmap, p, size);
+}
+
+// the length of a name, up to its end or the '=' after it
+static size_t name_len(const char *name) {
+  size_t len = 0;
+  while (name[len] != 0 && name[len] != '=')
+    len++;
+  return len;
+}
+
+// FNV-1a
+static uint32_t hash(const char *name, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char)name[i]) * 16777619u;
+  return h;
+}
+
+static int matches(const char *e, const char *name, size_t len) {
+  return memcmp(e, name, len) == 0 && e[len] == '=';
+}
+
+static void insert(struct index *ix, uint32_t h, size_t pos) {
+  size_t i = h & ix->mask;
+  while (ix->slots[i].pos != 0)
+    i = (i + 1) & ix->mask;
+  ix->slots[i].hash = h;
+  ix->slots[i].pos = pos + 1;
+  ix->count++;
+}
+
+// an index of the current environ, which has count entries
+static struct index *build(size_t count) {
+  size_t slots = MIN_SLOTS;
+  while (slots < count * 2)
+    slots *= 2;
+  size_t size = sizeof(struct index) + slots * sizeof(struct slot);
+  struct index *ix = map(size);
+  if (ix == 0)
+    return 0;
+
+  ix->environ = environ;
+  ix->first = environ[0];
+  ix->size = size;
+  ix->mask = slots - 1;
+  for (size_t i = 0; i < count; i++) {
+    size_t len = name_len(environ[i]);
+    uint32_t h = hash(environ[i], len);
+    // the first of several entries for a name is the one getenv() sees
+    size_t j = h & ix->mask;
+    for (; ix->slots[j].pos != 0; j = (j + 1) & ix->mask)
+      if (ix->slots[j].hash == h &&
+          matches(environ[ix->slots[j].pos - 1], environ[i], len))
+        break;
+    if (ix->slots[j].pos == 0)
+      insert(ix, h, i);
+  }
+  return ix;
+}
+
+// whether an index is of environ as it is now, as far as can be told cheaply
+static int fresh(const struct index *ix) {
+  return ix != 0 && environ != 0 && ix->environ == environ &&
+         ix->first == environ[0];
+}
+
+// the index of the current environ, built if need be, or 0 if there is none
+static struct index *current(void) {
+  struct index *ix = __atomic_load_n(&env_index, __ATOMIC_ACQUIRE);
+  if (fresh(ix))
+    return ix;
+  if (environ == 0)
+    return 0;
+
+  while (__atomic_exchange_n(&index_lock, 1, __ATOMIC_ACQUIRE))
+    __raw_syscall(SYS_sched_yield);
+  ix = env_index;
+  if (!fresh(ix)) {
+    size_t count = 0;
+    while (environ[count] != 0)
+      count++;
+    struct index *n = build(count);
+    if (n != 0) {
+      __atomic_store_n(&env_index, n, __ATOMIC_RELEASE);
+      if (ix != 0)
+        unmap(ix, ix->size);
+    }
+    ix = n;
+  }
+  __atomic_store_n(&index_lock, 0, __ATOMIC_RELEASE);
+  return ix;
+}
+
+// the position of a name in environ, or -1
+static ssize_t find(const char *name, size_t len, uint32_t h) {
+  struct index *ix;
+  while ((ix = current()) != 0) {
+    size_t i = h & ix->mask;
+    for (; ix->slots[i].pos != 0; i = (i + 1) & ix->mask) {
+      const struct slot *slot = &ix->slots[i];
+      if (slot->hash != h)
+        continue;
+      const char *e = environ[slot->pos - 1];
+      // the program has cut environ short itself, so the index is stale
+      if (e == 0)
         break;
-      if ((e[c] == '=') && (name[c] == 0 || name[c] == '='))
-        return e + c + 1;
+      if (matches(e, name, len))
+        return slot->pos - 1;
     }
+    if (ix->slots[i].pos == 0)
+      return -1;
+    __atomic_store_n(&ix->environ, 0, __ATOMIC_RELAXED);
   }
-  return 0;
+
+  for (size_t i = 0; environ != 0 && environ[i] != 0; i++)
+    if (matches(environ[i], name, len))
+      return i;
+  return -1;
 }
 
-int getenv_r(const char *name, char *buf, size_t len) {
+char *getenv(const char *name) {
+  size_t len = name_len(name);
+  uint32_t h = hash(name, len);
+  if (name[len] != 0)
+    return 0;
+  ssize_t pos = find(name, len, h);
+  return pos < 0 ? 0 : environ[pos] + len + 1;
+}
+__libc_hidden_def(getenv);
+
+__exported int getenv_r(const char *name, char *buf, size_t len) {
   char *env = getenv(name);
   if (env == NULL) {
     errno = ENOENT;
@@ -46,7 +235,7 @@ int getenv_r(const char *name, char *buf, size_t len) {
   return 0;
 }
 
-char *secure_getenv(const char *name) {
+__exported char *secure_getenv(const char *name) {
   /* Check that the caller is the effective user ID.
    *
    * ...is what my autocomplete told me to put.
@@ -63,73 +252,180 @@ char *secure_getenv(const char *name) {
   return getenv(name);
 }
 
-int unsetenv(const char *name) {
-  for (size_t i = 0; environ[i]; i++) {
-    char *e = environ[i];
-    for (size_t c = 0;; c++) {
-      if (e[c] != name[c])
-        break;
-      if (e[c] == '=') {
-        for (c = 0; e[c]; c++) {
-          e[c] = 0;
-        }
-      }
-    }
+/*
+ * Makes environ the array kept here, with room for one more entry, copying
+ * it the first time and moving it when it is full. The index follows it, as
+ * no entry moves.
+ */
+static int own(void) {
+  if (environ == entries && entries != 0 && entry_count + 1 < entry_capacity)
+    return 0;
+
+  size_t count = 0;
+  while (environ != 0 && environ[count] != 0)
+    count++;
+  size_t capacity = MIN_ENTRIES;
+  while (capacity < (count + 1) * 2)
+    capacity *= 2;
+  char **e = map(capacity * sizeof(char *));
+  struct string **s = map(capacity * sizeof(struct string *));
+  if (e == 0 || s == 0) {
+    unmap(e, capacity * sizeof(char *));
+    unmap(s, capacity * sizeof(struct string *));
+    errno = ENOMEM;
+    return -1;
   }
+
+  if (count != 0)
+    memcpy(e, environ, count * sizeof(char *));
+  // if the program has set environ itself, what it had may still be in use
+  if (environ == entries) {
+    memcpy(s, strings, count * sizeof(struct string *));
+    unmap(entries, entry_capacity * sizeof(char *));
+    unmap(strings, entry_capacity * sizeof(struct string *));
+  }
+
+  struct index *ix = env_index;
+  int indexed = ix != 0 && ix->environ == environ;
+  entries = environ = e;
+  strings = s;
+  entry_count = count;
+  entry_capacity = capacity;
+  if (indexed)
+    ix->environ = e;
   return 0;
 }
 
-int setenv(const char *name, const char *value, int force) {
-  for (size_t i = 0; environ[i]; i++) {
-    char *e = environ[i];
-    for (size_t c = 0;; c++) {
-      if (e[c] != name[c])
-        break;
-      if (e[c] == '=') {
-        if (!force)
-          goto success;
-        size_t len = strlen(e + c + 1);
-        size_t vlen = strlen(value);
-        if (len <= vlen) {
-          memcpy(e + c + 1, value, vlen);
-          for (c += (vlen + 1); e[c]; c++) {
-            e[c] = 0;
-          }
-          goto success;
-        } else {
-          /*
-           * we don't need to get the length of name,
-           * because at this point c is exactly that.
-           */
-          char *ne = malloc(c + vlen + 2);
-          memcpy(ne, name, c);
-          c++;
-          ne[c] = '=';
-          memcpy(ne + c, value, vlen);
-          environ[i] = ne;
-          free(e);
-          goto success;
-        }
-      }
+// a string with room for size bytes, from those set free or the arena
+static struct string *alloc_string(size_t size) {
+  for (struct string **p = &free_strings; *p != 0; p = &(*p)->next_free)
+    if ((*p)->capacity >= size) {
+      struct string *s = *p;
+      *p = s->next_free;
+      return s;
+    }
+
+  size_t need = (sizeof(struct string) + size + 15) & ~15UL;
+  if (need > ARENA_SIZE / 4) {
+    struct string *s = map(need);
+    if (s != 0)
+      s->capacity = need - sizeof(struct string);
+    return s;
+  }
+  if (need > arena_left) {
+    arena = map(ARENA_SIZE);
+    if (arena == 0) {
+      arena_left = 0;
+      return 0;
+    }
+    arena_left = ARENA_SIZE;
+  }
+  struct string *s = (struct string *)arena;
+  s->capacity = need - sizeof(struct string);
+  arena += need;
+  arena_left -= need;
+  return s;
+}
+
+// puts an entry at pos, which may be the end, keeping the index current
+static void set(ssize_t pos, char *e, struct string *s, uint32_t h) {
+  if (pos < 0) {
+    pos = entry_count++;
+    environ[entry_count] = 0;
+    struct index *ix = env_index;
+    if (ix != 0 && ix->environ == environ) {
+      if ((ix->count + 1) * 2 > ix->mask + 1)
+        ix->environ = 0;
+      else
+        insert(ix, h, pos);
     }
+  } else if (strings[pos] != 0 && strings[pos] != s) {
+    strings[pos]->next_free = free_strings;
+    free_strings = strings[pos];
   }
-  size_t i;
-  for (i = 0; environ[i]; i++)
-    ;
-  // we alloc *two* more, to account for a null terminator
-  char **nenviron = malloc(sizeof(char *) * (i + 2));
-  memcpy(nenviron, environ, sizeof(char *) * i);
-  size_t nlen = strlen(name);
+  environ[pos] = e;
+  strings[pos] = s;
+  if (pos == 0 && env_index != 0 && env_index->environ == environ)
+    env_index->first = e;
+}
+
+__exported int setenv(const char *name, const char *value, int force) {
+  size_t len = name_len(name);
+  uint32_t h = hash(name, len);
+  if (len == 0 || name[len] != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  ssize_t pos = find(name, len, h);
+  if (pos >= 0 && !force)
+    return 0;
+  if (own() != 0)
+    return -1;
+
+  // an entry of ours is rewritten in place if the value fits
   size_t vlen = strlen(value);
-  char *ne = malloc(nlen + vlen + 2);
-  memcpy(ne, name, nlen);
-  nlen++;
-  ne[nlen] = 'e';
-  memcpy(ne + nlen, value, vlen);
-  nenviron[i + 1] = ne;
-  nenviron[i + 2] = 0;
-  free(environ);
-  environ = nenviron;
-success:
+  struct string *s = pos >= 0 ? strings[pos] : 0;
+  if (s == 0 || s->capacity < len + vlen + 2)
+    s = alloc_string(len + vlen + 2);
+  if (s == 0) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  memcpy(s->s, name, len);
+  s->s[len] = '=';
+  memcpy(s->s + len + 1, value, vlen + 1);
+  set(pos, s->s, s, h);
+  return 0;
+}
+
+__exported int putenv(char *string) {
+  size_t len = name_len(string);
+  uint32_t h = hash(string, len);
+  if (len == 0 || string[len] != '=') {
+    errno = EINVAL;
+    return -1;
+  }
+
+  ssize_t pos = find(string, len, h);
+  if (own() != 0)
+    return -1;
+  set(pos, string, 0, h);
   return 0;
-}
\ No newline at end of file
+}
+
+__exported int unsetenv(const char *name) {
+  size_t len = name_len(name);
+  if (len == 0 || name[len] != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (environ == 0)
+    return 0;
+
+  int found = 0;
+  for (size_t i = 0; environ[i] != 0 && !found; i++)
+    found = matches(environ[i], name, len);
+  if (!found)
+    return 0;
+  if (own() != 0)
+    return -1;
+
+  // every entry for the name goes, the rest keep their order
+  size_t out = 0;
+  for (size_t i = 0; i < entry_count; i++) {
+    if (!matches(environ[i], name, len)) {
+      environ[out] = environ[i];
+      strings[out++] = strings[i];
+    } else if (strings[i] != 0) {
+      strings[i]->next_free = free_strings;
+      free_strings = strings[i];
+    }
+  }
+  environ[out] = 0;
+  entry_count = out;
+  if (env_index != 0)
+    env_index->environ = 0;
+  return 0;
+}
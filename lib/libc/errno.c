@@ -0,0 +1,10 @@
+#include <errno.h>
+#include <sys/cdefs.h>
+
+#include "tcb.h"
+
+// each thread's errno is in its TCB
+int *__errno_location(void) {
+  return __tcb_errno();
+}
+__libc_hidden_def(__errno_location);
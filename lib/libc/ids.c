@@ -0,0 +1,26 @@
+#include <sys/cdefs.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "syscall.h"
+
+// these never fail
+uid_t getuid(void) {
+  return __raw_syscall(SYS_getuid);
+}
+__libc_hidden_def(getuid);
+
+uid_t geteuid(void) {
+  return __raw_syscall(SYS_geteuid);
+}
+__libc_hidden_def(geteuid);
+
+gid_t getgid(void) {
+  return __raw_syscall(SYS_getgid);
+}
+__libc_hidden_def(getgid);
+
+gid_t getegid(void) {
+  return __raw_syscall(SYS_getegid);
+}
+__libc_hidden_def(getegid);
@@ -0,0 +1,19 @@
+#ifndef _PRIVATE_ERRNO_H
+#define _PRIVATE_ERRNO_H
+
+#include_next <errno.h>
+
+#include "hidden.h"
+#include "tcb.h"
+
+// for x86_64/syscall.S
+__libc_hidden_proto(__errno_location);
+
+/*
+ * Within libc, errno is found from the thread pointer inline, see tcb.h,
+ * rather than by calling __errno_location().
+ */
+#undef errno
+#define errno (*__tcb_errno())
+
+#endif /* _PRIVATE_ERRNO_H */
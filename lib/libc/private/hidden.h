@@ -0,0 +1,26 @@
+#ifndef _PRIVATE_HIDDEN_H
+#define _PRIVATE_HIDDEN_H
+
+#include <sys/cdefs.h>
+
+/*
+ * Calls from one libc function to another that is exported. Once its
+ * prototype has been through __libc_hidden_proto(), the name refers, within
+ * libc, to __libc_<name>, which is hidden, so calls to it are direct rather
+ * than through the PLT, can't be interposed, and can be inlined under LTO.
+ * The definition then goes by the hidden name too, and
+ * __libc_hidden_def(name) after it exports it under its own.
+ *
+ * The headers here that wrap public ones, such as string.h, have them for
+ * every exported function libc calls itself. Assembly calls __libc_<name>.
+ * They only take effect if this directory is searched before the installed
+ * headers, see the makefile; otherwise each __libc_hidden_def() is an alias
+ * of an undefined symbol, and the build fails.
+ */
+#define __libc_hidden_proto(name) \
+  extern __typeof__(name) name __asm__("__libc_" #name) __hidden
+#define __libc_hidden_def(name)                               \
+  extern __typeof__(name) __libc_export_##name __asm__(#name) \
+      __exported __attribute__((__alias__("__libc_" #name)))
+
+#endif /* _PRIVATE_HIDDEN_H */
@@ -0,0 +1,19 @@
+#ifndef _PRIVATE_STDLIB_H
+#define _PRIVATE_STDLIB_H
+
+#include_next <stdlib.h>
+
+#include "hidden.h"
+
+// C++ ABI, see atexit.c
+int __cxa_atexit(void (*)(void *), void *, void *);
+void __cxa_finalize(void *);
+
+__libc_hidden_proto(__cxa_atexit);
+__libc_hidden_proto(__cxa_finalize);
+__libc_hidden_proto(_Exit);
+__libc_hidden_proto(atexit);
+__libc_hidden_proto(exit);
+__libc_hidden_proto(getenv);
+
+#endif /* _PRIVATE_STDLIB_H */
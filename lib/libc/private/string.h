@@ -0,0 +1,14 @@
+#ifndef _PRIVATE_STRING_H
+#define _PRIVATE_STRING_H
+
+#include_next <string.h>
+
+#include "hidden.h"
+
+__libc_hidden_proto(memcmp);
+__libc_hidden_proto(memcpy);
+__libc_hidden_proto(memset);
+__libc_hidden_proto(strlcpy);
+__libc_hidden_proto(strlen);
+
+#endif /* _PRIVATE_STRING_H */
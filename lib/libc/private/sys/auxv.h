@@ -0,0 +1,10 @@
+#ifndef _PRIVATE_SYS_AUXV_H
+#define _PRIVATE_SYS_AUXV_H
+
+#include_next <sys/auxv.h>
+
+#include "hidden.h"
+
+__libc_hidden_proto(getauxval);
+
+#endif /* _PRIVATE_SYS_AUXV_H */
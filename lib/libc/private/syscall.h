@@ -0,0 +1,143 @@
+#ifndef _SYSCALL_H
+#define _SYSCALL_H
+
+#include <errno.h>
+#include <sys/cdefs.h>
+#include <sys/syscall.h>
+
+/*
+ * System calls made inline, for libc's own use, instead of through syscall()
+ * and scall() in x86_64/syscall.S, which move all six arguments whatever the
+ * call takes. __syscall0() to __syscall6() only load the registers the call
+ * uses, and return what the kernel does, -errno on failure. __raw_syscall()
+ * picks the right one by counting its arguments, and __scall() also turns a
+ * failure into errno and -1, as scall() does.
+ *
+ * The kernel clobbers rcx and r11. Memory is taken to be read and written, as
+ * any pointer passed might be.
+ *
+ * While syscall statistics are being kept, calls go through sysstat.c instead,
+ * except those that can return on another stack.
+ */
+
+extern int __sysstat_enabled __hidden;
+long __sysstat_syscall(long, long, long, long, long, long, long) __hidden;
+
+#define __sysstat_counts(n)                                      \
+  (__builtin_expect(__sysstat_enabled, 0) && (n) != SYS_clone && \
+   (n) != SYS_clone3 && (n) != SYS_vfork)
+
+static inline long __syscall0(long n) {
+  long ret;
+  if (__sysstat_counts(n))
+    return __sysstat_syscall(n, 0, 0, 0, 0, 0, 0);
+  __asm__ __volatile__("syscall" : "=a"(ret) : "a"(n) : "rcx", "r11", "memory");
+  return ret;
+}
+
+static inline long __syscall1(long n, long a) {
+  long ret;
+  if (__sysstat_counts(n))
+    return __sysstat_syscall(n, a, 0, 0, 0, 0, 0);
+  __asm__ __volatile__("syscall"
+                       : "=a"(ret)
+                       : "a"(n), "D"(a)
+                       : "rcx", "r11", "memory");
+  return ret;
+}
+
+static inline long __syscall2(long n, long a, long b) {
+  long ret;
+  if (__sysstat_counts(n))
+    return __sysstat_syscall(n, a, b, 0, 0, 0, 0);
+  __asm__ __volatile__("syscall"
+                       : "=a"(ret)
+                       : "a"(n), "D"(a), "S"(b)
+                       : "rcx", "r11", "memory");
+  return ret;
+}
+
+static inline long __syscall3(long n, long a, long b, long c) {
+  long ret;
+  if (__sysstat_counts(n))
+    return __sysstat_syscall(n, a, b, c, 0, 0, 0);
+  __asm__ __volatile__("syscall"
+                       : "=a"(ret)
+                       : "a"(n), "D"(a), "S"(b), "d"(c)
+                       : "rcx", "r11", "memory");
+  return ret;
+}
+
+static inline long __syscall4(long n, long a, long b, long c, long d) {
+  long ret;
+  if (__sysstat_counts(n))
+    return __sysstat_syscall(n, a, b, c, d, 0, 0);
+  register long r10 __asm__("r10") = d;
+  __asm__ __volatile__("syscall"
+                       : "=a"(ret)
+                       : "a"(n), "D"(a), "S"(b), "d"(c), "r"(r10)
+                       : "rcx", "r11", "memory");
+  return ret;
+}
+
+static inline long
+__syscall5(long n, long a, long b, long c, long d, long e) {
+  long ret;
+  if (__sysstat_counts(n))
+    return __sysstat_syscall(n, a, b, c, d, e, 0);
+  register long r10 __asm__("r10") = d;
+  register long r8 __asm__("r8") = e;
+  __asm__ __volatile__("syscall"
+                       : "=a"(ret)
+                       : "a"(n), "D"(a), "S"(b), "d"(c), "r"(r10), "r"(r8)
+                       : "rcx", "r11", "memory");
+  return ret;
+}
+
+static inline long
+__syscall6(long n, long a, long b, long c, long d, long e, long f) {
+  long ret;
+  if (__sysstat_counts(n))
+    return __sysstat_syscall(n, a, b, c, d, e, f);
+  register long r10 __asm__("r10") = d;
+  register long r8 __asm__("r8") = e;
+  register long r9 __asm__("r9") = f;
+  __asm__ __volatile__(
+      "syscall"
+      : "=a"(ret)
+      : "a"(n), "D"(a), "S"(b), "d"(c), "r"(r10), "r"(r8), "r"(r9)
+      : "rcx", "r11", "memory");
+  return ret;
+}
+
+// so pointers and narrower integers can be passed as they are
+#define __syscall1(n, a) __syscall1(n, (long)(a))
+#define __syscall2(n, a, b) __syscall2(n, (long)(a), (long)(b))
+#define __syscall3(n, a, b, c) \
+  __syscall3(n, (long)(a), (long)(b), (long)(c))
+#define __syscall4(n, a, b, c, d) \
+  __syscall4(n, (long)(a), (long)(b), (long)(c), (long)(d))
+#define __syscall5(n, a, b, c, d, e) \
+  __syscall5(n, (long)(a), (long)(b), (long)(c), (long)(d), (long)(e))
+#define __syscall6(n, a, b, c, d, e, f)                                    \
+  __syscall6(n, (long)(a), (long)(b), (long)(c), (long)(d), (long)(e), \
+             (long)(f))
+
+#define __SYSCALL_NARGS(...) __SYSCALL_NARGS_(__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define __SYSCALL_NARGS_(n, a, b, c, d, e, f, count, ...) count
+#define __SYSCALL_CAT(a, b) __SYSCALL_CAT_(a, b)
+#define __SYSCALL_CAT_(a, b) a##b
+
+#define __raw_syscall(...) \
+  __SYSCALL_CAT(__syscall, __SYSCALL_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#define __scall(...) __syscall_ret(__raw_syscall(__VA_ARGS__))
+
+static inline long __syscall_ret(unsigned long ret) {
+  if (__builtin_expect(ret > -4096UL, 0)) {
+    errno = -ret;
+    return -1;
+  }
+  return ret;
+}
+
+#endif /* _SYSCALL_H */
@@ -0,0 +1,74 @@
+#ifndef _TCB_H
+#define _TCB_H
+
+#include <sys/types.h>
+#include <linux/rseq.h>
+
+/*
+ * What libc reads from the thread control block, at the thread pointer. The
+ * TCB belongs to the dynamic linker, see struct dl_tcb in lib/rtld/private.h.
+ */
+
+// the thread's struct rseq
+#define TCB_RSEQ 0x40
+#define TCB_RSEQ_CPU_ID (TCB_RSEQ + 4)
+// the thread's syscall statistics, see sysstat.c
+#define TCB_SYSSTAT 0x60
+// errno, see errno.h
+#define TCB_ERRNO 0x68
+// the locale uselocale() set, or 0 for the global one
+#define TCB_LOCALE 0x70
+
+// the same layout, for static programs, which set up their own, see static.c
+struct __tcb {
+  struct __tcb *self;
+  void *dtv;
+  void *area;
+  size_t area_size;
+  unsigned long reserved;
+  unsigned long stack_guard;
+  void *profile;
+  struct rseq rseq;
+  void *sysstat;
+  int error;
+  void *locale;
+};
+static_assert(__builtin_offsetof(struct __tcb, rseq) == TCB_RSEQ);
+static_assert(__builtin_offsetof(struct __tcb, sysstat) == TCB_SYSSTAT);
+static_assert(__builtin_offsetof(struct __tcb, error) == TCB_ERRNO);
+static_assert(__builtin_offsetof(struct __tcb, locale) == TCB_LOCALE);
+
+// the TCB is at the thread pointer, and starts with a pointer to itself
+static inline struct __tcb *__tcb_self(void) {
+  struct __tcb *tcb;
+  __asm__("mov %%fs:0, %0" : "=r"(tcb));
+  return tcb;
+}
+
+static inline int *__tcb_errno(void) {
+  return &__tcb_self()->error;
+}
+
+static inline void *__tcb_locale(void) {
+  void *locale;
+  __asm__ __volatile__("mov %%fs:%c1, %0" : "=r"(locale) : "i"(TCB_LOCALE));
+  return locale;
+}
+
+static inline int __tcb_rseq_cpu_id(void) {
+  int cpu;
+  __asm__ __volatile__("movl %%fs:%c1, %0" : "=r"(cpu) : "i"(TCB_RSEQ_CPU_ID));
+  return cpu;
+}
+
+static inline void *__tcb_sysstat(void) {
+  void *p;
+  __asm__ __volatile__("mov %%fs:%c1, %0" : "=r"(p) : "i"(TCB_SYSSTAT));
+  return p;
+}
+
+static inline void __tcb_set_sysstat(void *p) {
+  __asm__ __volatile__("mov %0, %%fs:%c1" : : "r"(p), "i"(TCB_SYSSTAT));
+}
+
+#endif /* _TCB_H */
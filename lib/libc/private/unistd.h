@@ -0,0 +1,13 @@
+#ifndef _PRIVATE_UNISTD_H
+#define _PRIVATE_UNISTD_H
+
+#include_next <unistd.h>
+
+#include "hidden.h"
+
+__libc_hidden_proto(getegid);
+__libc_hidden_proto(geteuid);
+__libc_hidden_proto(getgid);
+__libc_hidden_proto(getuid);
+
+#endif /* _PRIVATE_UNISTD_H */
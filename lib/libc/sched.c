@@ -3,13 +3,19 @@
 #include <sys/syscall.h>
 #include <unistd.h>
 
+#include "hidden.h"
+#include "syscall.h"
+#include "tcb.h"
+
 #define __GNU_VISIBLE
 #define __BSD_VISIBLE
 #include <sched.h>
 
+__libc_hidden_proto(getcpu);
+
 __exported int sched_get_priority_min(int policy) {
 #ifdef SYS_sched_get_priority_min
-  return scall(SYS_sched_get_priority_min, policy);
+  return __scall(SYS_sched_get_priority_min, policy);
 #else
   errno = ENOSYS;
   return -1;
@@ -18,7 +24,7 @@ __exported int sched_get_priority_min(int policy) {
 
 __exported int sched_get_priority_max(int policy) {
 #ifdef SYS_sched_get_priority_max
-  return scall(SYS_sched_get_priority_max, policy);
+  return __scall(SYS_sched_get_priority_max, policy);
 #else
   errno = ENOSYS;
   return -1;
@@ -27,7 +33,7 @@ __exported int sched_get_priority_max(int policy) {
 
 __exported int sched_getparam(pid_t pid, struct sched_param *param) {
 #ifdef SYS_sched_getparam
-  return scall(SYS_sched_getparam, pid, param);
+  return __scall(SYS_sched_getparam, pid, param);
 #else
   errno = ENOSYS;
   return -1;
@@ -36,7 +42,7 @@ __exported int sched_getparam(pid_t pid, struct sched_param *param) {
 
 __exported int sched_setparam(pid_t pid, const struct sched_param *param) {
 #ifdef SYS_sched_setparam
-  return scall(SYS_sched_setparam, pid, param);
+  return __scall(SYS_sched_setparam, pid, param);
 #else
   errno = ENOSYS;
   return -1;
@@ -45,7 +51,7 @@ __exported int sched_setparam(pid_t pid, const struct sched_param *param) {
 
 __exported int sched_getscheduler(pid_t pid) {
 #ifdef SYS_sched_getscheduler
-  return scall(SYS_sched_getscheduler, pid);
+  return __scall(SYS_sched_getscheduler, pid);
 #else
   errno = ENOSYS;
   return -1;
@@ -55,7 +61,7 @@ __exported int sched_getscheduler(pid_t pid) {
 __exported int
 sched_setscheduler(pid_t pid, int policy, const struct sched_param *param) {
 #ifdef SYS_sched_setscheduler
-  return scall(SYS_sched_setscheduler, pid, policy, param);
+  return __scall(SYS_sched_setscheduler, pid, policy, param);
 #else
   errno = ENOSYS;
   return -1;
@@ -64,7 +70,7 @@ sched_setscheduler(pid_t pid, int policy, const struct sched_param *param) {
 
 __exported int sched_rr_get_interval(pid_t pid, struct timespec *t) {
 #ifdef SYS_sched_rr_get_interval
-  return scall(SYS_sched_setscheduler, pid, t);
+  return __scall(SYS_sched_rr_get_interval, pid, t);
 #else
   errno = ENOSYS;
   return -1;
@@ -74,7 +80,7 @@ __exported int sched_rr_get_interval(pid_t pid, struct timespec *t) {
 __exported int
 sched_getaffinity(pid_t pid, size_t cpusetsize, cpu_set_t *cpuset) {
 #ifdef SYS_sched_getaffinity
-  return scall(SYS_sched_getaffinity, cpusetsize, cpuset);
+  return __scall(SYS_sched_getaffinity, pid, cpusetsize, cpuset);
 #else
   errno = ENOSYS;
   return -1;
@@ -84,25 +90,29 @@ sched_getaffinity(pid_t pid, size_t cpusetsize, cpu_set_t *cpuset) {
 __exported int
 sched_setaffinity(pid_t pid, size_t cpusetsize, const cpu_set_t *cpuset) {
 #ifdef SYS_sched_setaffinity
-  return scall(SYS_sched_setaffinity, cpusetsize, cpuset);
+  return __scall(SYS_sched_setaffinity, pid, cpusetsize, cpuset);
 #else
   errno = ENOSYS;
   return -1;
 #endif
 }
 
-__exported int getcpu(unsigned *cpu, unsigned *node) {
+int getcpu(unsigned *cpu, unsigned *node) {
 #ifdef SYS_getcpu
-  // getcpu_cache
-  static char cache[128 / sizeof(long)];
-  return scall(SYS_getcpu, cpu, node, &cache);
+  // the cache argument has been unused since Linux 2.6.24
+  return __scall(SYS_getcpu, cpu, node, 0);
 #else
   errno = ENOSYS;
   return -1;
 #endif
 }
+__libc_hidden_def(getcpu);
 
 __exported int sched_getcpu(void) {
+  // kept up to date by the kernel while the thread is registered for rseq
+  int cpu = __tcb_rseq_cpu_id();
+  if (cpu >= 0)
+    return cpu;
 #ifdef SYS_getcpu
   // lives on stack
   struct {
@@ -120,7 +130,7 @@ __exported int sched_getcpu(void) {
 
 __exported int sched_yield(void) {
 #ifdef SYS_sched_yield
-  return scall(SYS_sched_yield);
+  return __scall(SYS_sched_yield);
 #else
   errno = ENOSYS;
   return -1;
@@ -129,7 +139,7 @@ __exported int sched_yield(void) {
 
 __exported int setns(int fd, int nstype) {
 #ifdef SYS_setns
-  return scall(SYS_setns, fd, nstype);
+  return __scall(SYS_setns, fd, nstype);
 #else
   errno = ENOSYS;
   return -1;
@@ -138,7 +148,7 @@ __exported int setns(int fd, int nstype) {
 
 __exported int unshare(unsigned long flags) {
 #ifdef SYS_unshare
-  return scall(SYS_setns, flags);
+  return __scall(SYS_unshare, flags);
 #else
   errno = ENOSYS;
   return -1;
@@ -147,7 +157,7 @@ __exported int unshare(unsigned long flags) {
 
 __exported int clone3(struct clone_args *args, size_t size) {
 #ifdef SYS_clone3
-  return scall(SYS_clone3, args, size);
+  return __scall(SYS_clone3, args, size);
 #else
   errno = ENOSYS;
   return -1;
@@ -0,0 +1,10 @@
+#include <asm/signal.h>
+#include <sys/cdefs.h>
+#include <sys/syscall.h>
+
+#include "syscall.h"
+
+// the kernel's sigset_t, as x86_64/sigsetjmp.S and siglongjmp.S pass it
+__exported int sigprocmask(int how, const sigset_t *set, sigset_t *old) {
+  return __scall(SYS_rt_sigprocmask, how, set, old, sizeof(sigset_t));
+}
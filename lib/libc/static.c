@@ -0,0 +1,123 @@
+#include <elf.h>
+#include <linux/mman.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/auxv.h>
+#include <sys/cdefs.h>
+#include <sys/rseq.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "syscall.h"
+#include "tcb.h"
+
+/*
+ * Startup for static programs, which have no dynamic linker to give the main
+ * thread its TCB. It is laid out the way rtld lays it out (lib/rtld/dl_tls.cc),
+ * with the program's TLS block, if it has one, right below the thread pointer
+ * and the program as the only module. Static PIE programs have been relocated
+ * by rcrt1.o already; static non-PIE ones only have IRELATIVE relocations,
+ * which the linker brackets with __rela_iplt_start and __rela_iplt_end, as it
+ * does the init and fini arrays.
+ */
+
+#define ARCH_SET_FS 0x1002
+
+extern const Elf64_Rela __rela_iplt_start[]
+    __attribute__((weak, visibility("hidden")));
+extern const Elf64_Rela __rela_iplt_end[]
+    __attribute__((weak, visibility("hidden")));
+
+typedef void (*init_fn)(int, char **, char **);
+extern const init_fn __preinit_array_start[]
+    __attribute__((weak, visibility("hidden")));
+extern const init_fn __preinit_array_end[]
+    __attribute__((weak, visibility("hidden")));
+extern const init_fn __init_array_start[]
+    __attribute__((weak, visibility("hidden")));
+extern const init_fn __init_array_end[]
+    __attribute__((weak, visibility("hidden")));
+extern void (*const __fini_array_start[])(void)
+    __attribute__((weak, visibility("hidden")));
+extern void (*const __fini_array_end[])(void)
+    __attribute__((weak, visibility("hidden")));
+// only in static PIEs, which needn't have PT_PHDR
+extern const Elf64_Dyn _DYNAMIC[] __attribute__((weak, visibility("hidden")));
+
+static void init_tls(void) {
+  const Elf64_Phdr *phdr = (const Elf64_Phdr *)getauxval(AT_PHDR);
+  unsigned long phnum = getauxval(AT_PHNUM), base = 0;
+  const Elf64_Phdr *tls = 0;
+  for (unsigned long i = 0; i < phnum; i++) {
+    if (phdr[i].p_type == PT_PHDR)
+      base = (unsigned long)phdr - phdr[i].p_vaddr;
+    else if (phdr[i].p_type == PT_DYNAMIC && _DYNAMIC != 0)
+      base = (unsigned long)_DYNAMIC - phdr[i].p_vaddr;
+    else if (phdr[i].p_type == PT_TLS)
+      tls = &phdr[i];
+  }
+
+  // the block sits where local-exec code expects it, its size rounded up to
+  // its own alignment below the thread pointer; the thread pointer itself is
+  // aligned to at least 32, which the TCB's struct rseq needs
+  unsigned long align = 32, size = 0;
+  if (tls != 0) {
+    unsigned long tls_align = tls->p_align != 0 ? tls->p_align : 1;
+    if (tls_align > align)
+      align = tls_align;
+    size = (tls->p_memsz + tls_align - 1) & ~(tls_align - 1);
+  }
+
+  // room to align the thread pointer, with the block below it
+  size_t area_size = size + align + sizeof(struct __tcb);
+  unsigned long area =
+      __raw_syscall(SYS_mmap, 0, area_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (area > -4096UL)
+    __raw_syscall(SYS_exit_group, 127);
+
+  // the rest of the block is .tbss, already zeroed
+  unsigned long tp = (area + size + align - 1) & ~(align - 1);
+  if (tls != 0)
+    memcpy((char *)tp - size, (const char *)(base + tls->p_vaddr),
+           tls->p_filesz);
+
+  struct __tcb *tcb = (struct __tcb *)tp;
+  tcb->self = tcb;
+  tcb->area = (void *)area;
+  tcb->area_size = area_size;
+  // the low byte stays zero, as in rtld
+  const unsigned long *random = (const unsigned long *)getauxval(AT_RANDOM);
+  if (random != 0)
+    tcb->stack_guard = *random & ~0xffUL;
+
+  if (__raw_syscall(SYS_arch_prctl, ARCH_SET_FS, tcb) < 0)
+    __raw_syscall(SYS_exit_group, 127);
+
+  tcb->rseq.cpu_id = RSEQ_CPU_ID_UNINITIALIZED;
+  if (__raw_syscall(SYS_rseq, &tcb->rseq, sizeof(tcb->rseq), 0, RSEQ_SIG) < 0)
+    tcb->rseq.cpu_id = RSEQ_CPU_ID_REGISTRATION_FAILED;
+}
+
+static void fini(void) {
+  for (size_t i = __fini_array_end - __fini_array_start; i != 0; i--)
+    __fini_array_start[i - 1]();
+}
+
+void __libc_init_static(int argc, char **argv, char **envp) {
+  init_tls();
+
+  for (const Elf64_Rela *rela = __rela_iplt_start; rela < __rela_iplt_end;
+       rela++) {
+    unsigned long (*resolver)(void) = (unsigned long (*)(void))rela->r_addend;
+    *(unsigned long *)rela->r_offset = resolver();
+  }
+
+  // registered first, so the fini array runs after every atexit() handler
+  atexit(fini);
+  for (const init_fn *fn = __preinit_array_start; fn < __preinit_array_end;
+       fn++)
+    (*fn)(argc, argv, envp);
+  for (const init_fn *fn = __init_array_start; fn < __init_array_end; fn++)
+    (*fn)(argc, argv, envp);
+}
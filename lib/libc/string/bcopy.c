@@ -134,3 +134,6 @@ done:
 	return;
 #endif
 }
+#ifdef MEMCOPY
+__libc_hidden_def(memcpy);
+#endif
@@ -50,3 +50,4 @@ memcmp(const void *s1, const void *s2, size_t n)
 	}
 	return (0);
 }
+__libc_hidden_def(memcmp);
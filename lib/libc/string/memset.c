@@ -129,3 +129,6 @@ memset(void *dst0, int c0, size_t length)
 		} while (--t != 0);
 	RETURN;
 }
+#ifndef BZERO
+__libc_hidden_def(memset);
+#endif
@@ -50,3 +50,4 @@ strlcpy(char * __restrict dst, const char * __restrict src, size_t dsize)
 
 	return(src - osrc - 1);	/* count does not include NUL */
 }
+__libc_hidden_def(strlcpy);
@@ -108,7 +108,7 @@ strlen(const char *str)
 			testbyte(1);
 			testbyte(2);
 			testbyte(3);
-#if (LONG_BIT >= 64)
+#if __BITS_PER_LONG >= 64
 			testbyte(4);
 			testbyte(5);
 			testbyte(6);
@@ -120,3 +120,4 @@ strlen(const char *str)
 	/* NOTREACHED */
 	return (0);
 }
+__libc_hidden_def(strlen);
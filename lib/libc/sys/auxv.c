@@ -4,13 +4,13 @@
 
 const Elf64_auxv_t *_auxv;
 
-__exported unsigned long getauxval(unsigned long type) {
+unsigned long getauxval(unsigned long type) {
   if (type == AT_NULL)
     goto fail;
 
   const Elf64_auxv_t *auxv = _auxv;
 
-  while (auxv->a_type != AT_NULL)
+  for (; auxv->a_type != AT_NULL; auxv++)
     if (auxv->a_type == type)
       return auxv->a_un.a_val;
 
@@ -18,3 +18,4 @@ fail:
   errno = ENOENT;
   return 0;
 }
+__libc_hidden_def(getauxval);
@@ -0,0 +1,305 @@
+#include <asm-generic/signal-defs.h>
+#include <elf.h>
+#include <linux/mman.h>
+#include <linux/time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/cdefs.h>
+#include <sys/syscall.h>
+
+#include "tcb.h"
+
+/*
+ * Syscall statistics. With MATAGOT_SYSSTAT set (to anything but 0), every
+ * system call libc makes, through syscall() or the inline wrappers in
+ * private/syscall.h, is counted by number, along with its failures and a
+ * histogram of how long it took in powers of two of TSC ticks. A summary in
+ * the manner of strace -c goes to stderr at exit, and each time the signal
+ * numbered MATAGOT_SYSSTAT_SIGNAL, if set, is received. Like LD_DEBUG, both
+ * are ignored for setuid/setgid programs.
+ *
+ * Each thread counts into a buffer of its own, found through its TCB, so a
+ * call costs no atomics. Buffers are chained together for the summary, which
+ * adds them up as they stand, and outlive their threads, so that what those
+ * did still shows. Ticks are turned into nanoseconds by comparing the TSC with
+ * CLOCK_MONOTONIC over the time statistics have been kept.
+ *
+ * It starts from libc's initializer, which in a dynamically linked program
+ * runs before any other but the dynamic linker's own work, which isn't
+ * counted, nor are calls made with the syscall instruction directly.
+ */
+
+#define COUNTED 512
+#define BUCKETS 32
+#define OUT_MAX 0x2000
+
+#ifndef SA_RESTORER
+#define SA_RESTORER 0x04000000
+#endif
+
+struct counter {
+  unsigned long calls, errors, ticks;
+  // calls taking from 2^(i-1) up to 2^i ticks, the last one all longer calls
+  unsigned long buckets[BUCKETS];
+};
+
+struct buffer {
+  struct buffer *next;
+  // by number, with those above COUNTED sharing the last entry
+  struct counter counters[COUNTED + 1];
+};
+
+// the kernel's struct sigaction
+struct ksigaction {
+  void (*handler)(int);
+  unsigned long flags;
+  void (*restorer)(void);
+  unsigned long mask;
+};
+
+int __sysstat_enabled;
+static struct buffer *buffers;
+static unsigned long long start_tsc, start_ns;
+
+static char out[OUT_MAX];
+static size_t out_len;
+static int printing;
+
+static long raw(long n, long a, long b, long c, long d, long e, long f) {
+  long ret;
+  register long r10 __asm__("r10") = d;
+  register long r8 __asm__("r8") = e;
+  register long r9 __asm__("r9") = f;
+  __asm__ __volatile__(
+      "syscall"
+      : "=a"(ret)
+      : "a"(n), "D"(a), "S"(b), "d"(c), "r"(r10), "r"(r8), "r"(r9)
+      : "rcx", "r11", "memory");
+  return ret;
+}
+
+static unsigned long long monotonic_ns(void) {
+  struct __kernel_timespec ts;
+  raw(SYS_clock_gettime, CLOCK_MONOTONIC, (long)&ts, 0, 0, 0, 0);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// gives the calling thread a buffer
+static struct buffer *attach(void) {
+  unsigned long addr =
+      raw(SYS_mmap, 0, sizeof(struct buffer), PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (addr > -4096UL)
+    return 0;
+
+  struct buffer *buf = (struct buffer *)addr;
+  buf->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&buffers, &buf->next, buf, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  __tcb_set_sysstat(buf);
+  return buf;
+}
+
+// makes a call, counting it; see private/syscall.h and x86_64/syscall.S
+long __sysstat_syscall(
+    long n, long a, long b, long c, long d, long e, long f) {
+  struct buffer *buf = __tcb_sysstat();
+  if (buf == 0)
+    buf = attach();
+
+  unsigned long long start = __builtin_ia32_rdtsc();
+  long ret = raw(n, a, b, c, d, e, f);
+  unsigned long long ticks = __builtin_ia32_rdtsc() - start;
+  if (buf == 0)
+    return ret;
+
+  struct counter *counter =
+      &buf->counters[(unsigned long)n < COUNTED ? n : COUNTED];
+  counter->calls++;
+  counter->errors += (unsigned long)ret > -4096UL;
+  counter->ticks += ticks;
+  int bucket = ticks == 0 ? 0 : 64 - __builtin_clzll(ticks);
+  counter->buckets[bucket < BUCKETS ? bucket : BUCKETS - 1]++;
+  return ret;
+}
+
+static void flush(void) {
+  raw(SYS_write, 2, (long)out, out_len, 0, 0, 0);
+  out_len = 0;
+}
+
+static void put(const char *s) {
+  for (; *s != 0; s++) {
+    if (out_len == OUT_MAX)
+      flush();
+    out[out_len++] = *s;
+  }
+}
+
+// a number right aligned in width columns
+static void put_num(unsigned long long n, size_t width) {
+  char digits[20];
+  size_t len = 0;
+  do
+    digits[len++] = '0' + n % 10;
+  while ((n /= 10) != 0);
+
+  for (; width > len; width--)
+    put(" ");
+  while (len != 0) {
+    char c[2] = {digits[--len], 0};
+    put(c);
+  }
+}
+
+// a name left aligned in width columns
+static void put_name(const char *s, size_t width) {
+  put(s);
+  for (size_t len = strlen(s); len < width; len++)
+    put(" ");
+}
+
+static const char *const names[COUNTED] = {
+#include "syscall_names.h"
+};
+
+// one syscall number's counters, added up over every thread
+static void sum(size_t n, struct counter *total) {
+  memset(total, 0, sizeof(*total));
+  for (struct buffer *buf = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE);
+       buf != 0; buf = buf->next) {
+    const struct counter *c = &buf->counters[n];
+    total->calls += c->calls;
+    total->errors += c->errors;
+    total->ticks += c->ticks;
+    for (size_t i = 0; i < BUCKETS; i++)
+      total->buckets[i] += c->buckets[i];
+  }
+}
+
+static void
+print_counter(size_t n, const struct counter *c, double ns_per_tick) {
+  if (n < COUNTED && names[n] != 0) {
+    put_name(names[n], 20);
+  } else if (n < COUNTED) {
+    put("#");
+    put_num(n, 0);
+    put_name("", n < 10 ? 18 : n < 100 ? 17 : 16);
+  } else {
+    put_name("(other)", 20);
+  }
+
+  put_num(c->calls, 10);
+  put_num(c->errors, 9);
+  put_num(c->ticks * ns_per_tick, 15);
+  put_num(c->ticks * ns_per_tick / c->calls, 11);
+  put("\n");
+
+  // the non-empty buckets, each by how long its calls took at most
+  put("    ns:");
+  for (size_t i = 0; i < BUCKETS; i++) {
+    if (c->buckets[i] == 0)
+      continue;
+    int last = i == BUCKETS - 1;
+    put(last ? " >" : " <");
+    put_num((1ULL << (last ? i - 1 : i)) * ns_per_tick + 1, 0);
+    put(":");
+    put_num(c->buckets[i], 0);
+  }
+  put("\n");
+}
+
+static void print(void) {
+  // a signal arriving mid summary is ignored
+  if (__atomic_exchange_n(&printing, 1, __ATOMIC_ACQUIRE))
+    return;
+
+  unsigned long long ns = monotonic_ns() - start_ns;
+  unsigned long long ticks = __builtin_ia32_rdtsc() - start_tsc;
+  double ns_per_tick = ticks != 0 ? (double)ns / ticks : 0;
+
+  put("sysstat: pid ");
+  put_num(raw(SYS_getpid, 0, 0, 0, 0, 0, 0), 0);
+  put(", ");
+  put_num(ns, 0);
+  put(" ns\n");
+  put_name("syscall", 20);
+  put("     calls   errors       total ns    ns/call\n");
+
+  struct counter total, all;
+  memset(&all, 0, sizeof(all));
+  for (size_t n = 0; n <= COUNTED; n++) {
+    sum(n, &total);
+    if (total.calls == 0)
+      continue;
+    print_counter(n, &total, ns_per_tick);
+    all.calls += total.calls;
+    all.errors += total.errors;
+    all.ticks += total.ticks;
+  }
+
+  put_name("total", 20);
+  put_num(all.calls, 10);
+  put_num(all.errors, 9);
+  put_num(all.ticks * ns_per_tick, 15);
+  put("\n");
+  flush();
+  __atomic_store_n(&printing, 0, __ATOMIC_RELEASE);
+}
+
+static void on_signal(int sig) {
+  (void)sig;
+  print();
+}
+
+// returns from on_signal()
+__asm__(".pushsection .text\n"
+        "sysstat_restore:\n"
+        "\tmov $15, %eax\n" // rt_sigreturn
+        "\tsyscall\n"
+        ".popsection\n");
+void sysstat_restore(void);
+
+static const char *env_value(char **envp, const char *name, size_t len) {
+  for (; *envp != 0; envp++)
+    if (memcmp(*envp, name, len) == 0 && (*envp)[len] == '=')
+      return *envp + len + 1;
+  return 0;
+}
+
+// environ and the auxiliary vector aren't set up yet when this runs
+__attribute__((constructor)) static void init(int argc, char **argv,
+                                              char **envp) {
+  (void)argc;
+  (void)argv;
+  const char *env = env_value(envp, "MATAGOT_SYSSTAT", 15);
+  if (env == 0 || env[0] == 0 || (env[0] == '0' && env[1] == 0))
+    return;
+
+  char **p = envp;
+  while (*p != 0)
+    p++;
+  for (const Elf64_auxv_t *auxv = (const Elf64_auxv_t *)(p + 1);
+       auxv->a_type != AT_NULL; auxv++)
+    if (auxv->a_type == AT_SECURE && auxv->a_un.a_val != 0)
+      return;
+
+  start_ns = monotonic_ns();
+  start_tsc = __builtin_ia32_rdtsc();
+  // in a dynamically linked program, this runs after every finalizer
+  atexit(print);
+
+  const char *sig = env_value(envp, "MATAGOT_SYSSTAT_SIGNAL", 22);
+  if (sig != 0) {
+    int n = 0;
+    for (; *sig >= '0' && *sig <= '9'; sig++)
+      n = n * 10 + *sig - '0';
+    struct ksigaction sa = {
+        on_signal, SA_RESTART | SA_RESTORER, sysstat_restore, 0};
+    if (n > 0 && *sig == 0)
+      raw(SYS_rt_sigaction, n, (long)&sa, 0, sizeof(sa.mask), 0, 0);
+  }
+
+  __atomic_store_n(&__sysstat_enabled, 1, __ATOMIC_RELEASE);
+}
@@ -1,9 +1,10 @@
 #include "private.h"
 
-Elf64_auxv_t *_auxv;
+// not _auxv, which libc defines for itself, see RTLD_LIBC in the makefile
+Elf64_auxv_t *_dl_auxv;
 
 unsigned long _getauxval(unsigned long key) {
-  Elf64_auxv_t *auxv = _auxv;
+  Elf64_auxv_t *auxv = _dl_auxv;
   while (auxv->a_type != AT_NULL) {
     if (auxv->a_type == key) {
       return auxv->a_un.a_val;
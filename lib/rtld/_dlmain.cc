@@ -1,5 +1,139 @@
+#include <sys/stat.h>
+
 #include "private.h"
 
-extern "C" void _dlmain(Elf64_auxv_t *auxv) {
-  _auxv = auxv;
+/*
+ * Reports an error and exits, or during dlopen() leaves the message for
+ * dlerror() and unwinds back to dlopen(), which unloads what it had loaded.
+ */
+extern "C" void _dl_fatal(const char *msg, const char *arg) {
+  if (_dl_catch != 0) {
+    _dl_set_error(msg, arg);
+    __builtin_longjmp(_dl_catch, 1);
+  }
+
+  write(2, "ld-elf.so: ", 11);
+  write(2, msg, strlen(msg));
+  if (arg != 0) {
+    write(2, ": ", 2);
+    write(2, arg, strlen(arg));
+  }
+  write(2, "\n", 1);
+  exit(127);
+  __unreachable();
+}
+
+extern "C" void _dlmain(int argc, char **envp, Elf64_auxv_t *auxv) {
+  unsigned long long start = dl_rdtsc();
+  _dl_auxv = auxv;
+  _dl_envp = envp;
+  _dl_stats_init(start);
+  _dl_profile_init();
+  _dl_lazy_init();
+  _dl_search_init();
+
+  // the executable, which the kernel has already mapped
+  const Elf64_Phdr *phdr = (const Elf64_Phdr *)_getauxval(AT_PHDR);
+  size_t phnum = _getauxval(AT_PHNUM);
+  unsigned long base = 0;
+  const char *interp = "ld-elf.so";
+  for (size_t i = 0; i < phnum; i++)
+    if (phdr[i].p_type == PT_PHDR)
+      base = (unsigned long)phdr - phdr[i].p_vaddr;
+  for (size_t i = 0; i < phnum; i++)
+    if (phdr[i].p_type == PT_INTERP)
+      interp = (const char *)(base + phdr[i].p_vaddr);
+  const char *prefetch = _dl_getenv("LD_PREFETCH");
+  if (prefetch != 0 && prefetch[0] == '0')
+    _dl_prefetch = 0;
+  const char *hugepage = _dl_getenv("LD_HUGEPAGE");
+  if (hugepage != 0 && hugepage[0] == '0')
+    _dl_hugepage = 0;
+  const char *nodirect = _dl_getenv("LD_NODIRECT");
+  if (nodirect != 0 && nodirect[0] != 0)
+    _dl_direct = 0;
+  dl_stats_end(&_dl_stats.phase[DL_PHASE_SETUP], start);
+
+  unsigned long long t = dl_stats_begin();
+  dl_object *exe = dl_object::from_image(base, phdr, phnum, "");
+  exe->prefetch();
+  exe->advise_hugepage();
+
+  // the dynamic linker itself, so DT_NEEDED entries naming it resolve to it
+  Elf64_Ehdr *ehdr = (Elf64_Ehdr *)_getauxval(AT_BASE);
+  dl_object *rtld = dl_object::from_image(
+      (unsigned long)ehdr, (const Elf64_Phdr *)((char *)ehdr + ehdr->e_phoff),
+      ehdr->e_phnum, interp);
+  struct stat st;
+  if (stat(interp, &st) == 0) {
+    rtld->dev = st.st_dev;
+    rtld->ino = st.st_ino;
+  }
+  _dl_register(rtld);
+#ifdef RTLD_LIBC
+  /*
+   * libc is linked in, so it stands in for libc.so too. _start only applied
+   * RELATIVE relocations, which are harmless to apply again; libc's data
+   * references still need relocating, after any copy relocations.
+   */
+  _dl_register_name(rtld, "libc.so");
+#else
+  // _start already did this
+  rtld->flags |= DL_OBJ_RELOCATED;
+#endif
+
+  /*
+   * debuggers find _r_debug through the executable's DT_DEBUG entry, if its
+   * dynamic section is writable
+   */
+  _r_debug.r_version = 1;
+  _r_debug.r_map = _dl_head;
+  _r_debug.r_brk =
+      (void (*)(struct r_debug *, struct link_map *))_dl_debug_state;
+  _r_debug.r_state = r_debug::RT_CONSISTENT;
+  _r_debug.r_ldbase = ehdr;
+  for (size_t i = 0; i < phnum; i++) {
+    if (phdr[i].p_type != PT_LOAD || !(phdr[i].p_flags & PF_W))
+      continue;
+
+    for (Elf64_Dyn *dyn = (Elf64_Dyn *)exe->map.l_ld;
+         dyn != 0 && dyn->d_tag != DT_NULL; dyn++) {
+      unsigned long addr = (unsigned long)dyn - base;
+      if (dyn->d_tag == DT_DEBUG && addr >= phdr[i].p_vaddr &&
+          addr < phdr[i].p_vaddr + phdr[i].p_memsz)
+        dyn->d_un.d_ptr = (Elf64_Addr)&_r_debug;
+    }
+  }
+
+  // objects are appended to the chain as they're found, so walking it while
+  // loading goes breadth first
+  for (struct link_map *lm = _dl_head; lm != 0; lm = lm->l_next) {
+    dl_object *obj = (dl_object *)lm;
+    obj->flags |= DL_OBJ_GLOBAL | DL_OBJ_NODELETE;
+    obj->parse_dynamic();
+    obj->load_needed(true);
+  }
+  _dl_lazy_prepare();
+  dl_stats_end(&_dl_stats.phase[DL_PHASE_LOAD], t);
+
+  t = dl_stats_begin();
+  _dl_tls_init();
+  dl_stats_end(&_dl_stats.phase[DL_PHASE_TLS], t);
+
+  t = dl_stats_begin();
+  _dl_bind_cache_open();
+  _dl_relocate_all(1);
+  _dl_bind_cache_close();
+  _dl_tls_relocated();
+  dl_stats_end(&_dl_stats.phase[DL_PHASE_RELOC], t);
+
+  _dl_phdr_publish();
+  _dl_debug_state();
+
+  t = dl_stats_begin();
+  _dl_init_start(argc, envp - argc - 1, envp);
+  dl_stats_end(&_dl_stats.phase[DL_PHASE_INIT], t);
+
+  if (_dl_stats_enabled)
+    _dl_stats_print();
 }
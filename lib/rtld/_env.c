@@ -0,0 +1,11 @@
+#include "private.h"
+
+char **_dl_envp;
+
+const char *_dl_getenv(const char *name) {
+  size_t len = strlen(name);
+  for (char **e = _dl_envp; *e != 0; e++)
+    if (strncmp(*e, name, len) == 0 && (*e)[len] == '=')
+      return *e + len + 1;
+  return 0;
+}
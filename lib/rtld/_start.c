@@ -4,82 +4,117 @@
 
 #include "private.h"
 
-__exported void _start() {
-  register volatile long *sp __asm__("%sp");
-  // store the stack register pointer
-  volatile long *store_sp = sp;
+/*
+ * The kernel enters with argc where the stack pointer is, which a C function
+ * can't see past its own frame, so _start passes it on and realigns the stack.
+ */
+__asm__(".text\n"
+        ".global _start\n"
+        "_start:\n"
+        "  xor %ebp, %ebp\n"
+        "  mov %rsp, %rdi\n"
+        "  and $-16, %rsp\n"
+        "  call _dl_start\n");
 
+__attribute__((used)) void _dl_start(long *store_sp) {
   /*
-   * obtain the auxv from the stack pointer without handling args and skipping
-   * through envp
+   * obtain envp and the auxv from the stack pointer without handling args;
+   * envp starts after argc, the args, and their null terminator
    */
-  char **envp = (char **)store_sp + store_sp[0];
-  while (*++envp != 0)
-    ;
-  Elf64_auxv_t *auxv = (Elf64_auxv_t *)++envp;
+  char **envp = (char **)store_sp + store_sp[0] + 2;
+  char **envp_end = envp;
+  while (*envp_end != 0)
+    envp_end++;
+  Elf64_auxv_t *auxv = (Elf64_auxv_t *)++envp_end;
 
   /*
    * after calculating the auxv, obtain the ELF header from AT_BASE (base
    * address of the dynamic linker)
    */
-  Elf64_Ehdr *ehdr = (void *)auxv[AT_BASE].a_un.a_val;
+  Elf64_Ehdr *ehdr = 0;
+  for (Elf64_auxv_t *a = auxv; a->a_type != AT_NULL; a++)
+    if (a->a_type == AT_BASE)
+      ehdr = (void *)a->a_un.a_val;
   // get program headers address from ehdr
   char *phdrs = (char *)ehdr + ehdr->e_phoff;
 
   // iterate through program headers
-  Elf64_Phdr *dynamic = 0;
+  Elf64_Dyn *dyn_table = 0;
   for (int i = ehdr->e_phnum; i != 0; i--) {
     Elf64_Phdr *phdr = (Elf64_Phdr *)phdrs;
 
     // the PT_DYNAMIC dynamic table contains info on relocations
     if (phdr->p_type == PT_DYNAMIC) {
-      dynamic = (void *)((char *)ehdr + phdr->p_offset);
+      dyn_table = (Elf64_Dyn *)((char *)ehdr + phdr->p_vaddr);
       break;
     }
 
     phdrs += ehdr->e_phentsize;
   }
 
-  // the dynamic table itself
-  Elf64_Dyn *dyn_table = (Elf64_Dyn *)((char *)ehdr + dynamic->p_offset);
-
-  // calculate the number of rel symbols from total size (sz) and entry size
-  int rel_num =
-      dyn_table[DT_RELSZ].d_un.d_val / dyn_table[DT_RELENT].d_un.d_val;
-  // calculate rel table address and perform relocations
-  Elf64_Rel *rel_table =
-      (Elf64_Rel *)((char *)ehdr + dyn_table[DT_REL].d_un.d_ptr);
-  for (int i = 0; i < rel_num; i++) {
-    switch (rel_table[i].r_info) {
-    case R_TARGET_RELATIVE:
-      rel_table[i].r_offset += (unsigned long)ehdr;
+  /*
+   * the dynamic table is a list of tagged entries, not indexed by tag, so
+   * collect what we need from it
+   */
+  Elf64_Rel *rel_table = 0;
+  Elf64_Rela *rela_table = 0;
+  unsigned long relsz = 0, relent = sizeof(Elf64_Rel);
+  unsigned long relasz = 0, relaent = sizeof(Elf64_Rela);
+  for (Elf64_Dyn *dyn = dyn_table; dyn->d_tag != DT_NULL; dyn++) {
+    switch (dyn->d_tag) {
+    case DT_REL:
+      rel_table = (Elf64_Rel *)((char *)ehdr + dyn->d_un.d_ptr);
+      break;
+    case DT_RELSZ:
+      relsz = dyn->d_un.d_val;
       break;
-    default:
+    case DT_RELENT:
+      relent = dyn->d_un.d_val;
+      break;
+    case DT_RELA:
+      rela_table = (Elf64_Rela *)((char *)ehdr + dyn->d_un.d_ptr);
+      break;
+    case DT_RELASZ:
+      relasz = dyn->d_un.d_val;
+      break;
+    case DT_RELAENT:
+      relaent = dyn->d_un.d_val;
       break;
     }
   }
 
+  /*
+   * only relative relocations are applied here, as they're all the linker
+   * itself should have; the rest of the linker can't run before this
+   */
+  int rel_num = relsz / relent;
+  for (int i = 0; i < rel_num; i++) {
+    if (ELF64_R_TYPE(rel_table[i].r_info) == R_TARGET_RELATIVE)
+      *(unsigned long *)((char *)ehdr + rel_table[i].r_offset) +=
+          (unsigned long)ehdr;
+  }
+
   // dito but for rela (rel with addends)
-  int rela_num =
-      dyn_table[DT_RELASZ].d_un.d_val / dyn_table[DT_RELENT].d_un.d_val;
-  Elf64_Rela *rela_table =
-      (Elf64_Rela *)((char *)ehdr + dyn_table[DT_RELA].d_un.d_val);
+  int rela_num = relasz / relaent;
   for (int i = 0; i < rela_num; i++) {
-    switch (rela_table[i].r_info) {
-    case R_TARGET_RELATIVE:
-      rela_table[i].r_offset = (unsigned long)ehdr + rela_table[i].r_addend;
-      break;
-    default:
-      break;
-    }
+    if (ELF64_R_TYPE(rela_table[i].r_info) == R_TARGET_RELATIVE)
+      *(unsigned long *)((char *)ehdr + rela_table[i].r_offset) =
+          (unsigned long)ehdr + rela_table[i].r_addend;
   }
 
   // jump to main linker routine
-  _dlmain(auxv);
+  _dlmain(store_sp[0], envp, auxv);
 
-  // retrieve the entry point, restore stack to original value, and call
-  volatile register void (*entry)() = (void *)auxv[AT_ENTRY].a_un.a_val;
-  sp = store_sp;
-  entry();
+  /*
+   * enter the program as the kernel would have, on the original stack, with
+   * rdx holding the function it should register with atexit()
+   */
+  unsigned long entry = _getauxval(AT_ENTRY);
+  __asm__ __volatile__("mov %0, %%rsp\n\t"
+                       "xor %%ebp, %%ebp\n\t"
+                       "jmp *%1"
+                       :
+                       : "r"(store_sp), "r"(entry), "d"(_dl_fini)
+                       : "memory");
   __unreachable();
 }
@@ -0,0 +1,145 @@
+#include "private.h"
+
+/*
+ * Since we don't have malloc in a freestanding environment, every internal
+ * allocation of the dynamic linker comes from this arena: object metadata,
+ * names, search paths and hash tables alike.
+ *
+ * Memory is bumped out of large chunks, which cost nothing until they are
+ * touched, so most startups only ever mmap one. Freed blocks go on a free list
+ * for their size class and are reused before the chunk is bumped again. Sizes
+ * up to 256 bytes have a class every 16 bytes, and larger ones are rounded up
+ * to a power of two. Anything too large for a class gets its own mapping.
+ *
+ * With LD_ARENA_HUGEPAGE=1, chunks are aligned and advised for transparent
+ * huge pages, trading resident memory for fewer TLB misses.
+ *
+ * The arena is not thread safe; after startup, callers hold the loader lock.
+ */
+
+#define CHUNK_SIZE 0x200000
+#define ALIGN 16
+#define SMALL_MAX 256
+#define LARGE_MIN 0x10000
+// 16 byte steps up to SMALL_MAX, then powers of two below LARGE_MIN
+#define CLASSES (SMALL_MAX / ALIGN + 8)
+
+struct free_block {
+  free_block *next;
+};
+
+static char *cur, *end;
+static free_block *free_lists[CLASSES];
+static int hugepage = -1;
+
+struct dl_arena_stats _dl_arena_stats;
+
+// returns the class index for a size, rounding the size up to the class size
+static unsigned int size_class(size_t *size) {
+  if (*size <= SMALL_MAX) {
+    *size = (*size + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+    if (*size == 0)
+      *size = ALIGN;
+    return *size / ALIGN - 1;
+  }
+
+  unsigned int i = SMALL_MAX / ALIGN;
+  size_t c = SMALL_MAX * 2;
+  for (; c < *size; c <<= 1)
+    i++;
+  *size = c;
+  return i;
+}
+
+static uintptr_t map(size_t len) {
+  uintptr_t addr = mmap(
+      0, len, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  expect(addr);
+
+  _dl_arena_stats.mmaps++;
+  _dl_arena_stats.reserved += len;
+  return addr;
+}
+
+static void new_chunk() {
+  if (hugepage < 0) {
+    const char *env = _dl_getenv("LD_ARENA_HUGEPAGE");
+    hugepage = env != 0 && env[0] == '1';
+  }
+
+  uintptr_t chunk;
+  if (hugepage) {
+    // over-reserve, then trim to a huge page aligned chunk
+    uintptr_t region = map(CHUNK_SIZE * 2);
+    chunk = (region + CHUNK_SIZE - 1) & ~(uintptr_t)(CHUNK_SIZE - 1);
+    if (chunk != region)
+      munmap(region, chunk - region);
+    munmap(chunk + CHUNK_SIZE, region + CHUNK_SIZE - chunk);
+    _dl_arena_stats.reserved -= CHUNK_SIZE;
+    madvise(chunk, CHUNK_SIZE, MADV_HUGEPAGE);
+  } else {
+    chunk = map(CHUNK_SIZE);
+  }
+
+  // what was left of the last chunk is abandoned
+  cur = (char *)chunk;
+  end = cur + CHUNK_SIZE;
+}
+
+// allocates zeroed memory, aligned to 16 bytes
+extern "C" void *_dl_alloc(size_t size) {
+  if (size >= LARGE_MIN) {
+    size_t pagesz = _getauxval(AT_PAGESZ);
+    size = (size + pagesz - 1) & ~(pagesz - 1);
+    _dl_arena_stats.used += size;
+    return (void *)map(size);
+  }
+
+  unsigned int i = size_class(&size);
+  _dl_arena_stats.used += size;
+
+  free_block *block = free_lists[i];
+  if (block != 0) {
+    free_lists[i] = block->next;
+    return memset(block, 0, size);
+  }
+
+  if ((size_t)(end - cur) < size)
+    new_chunk();
+  void *p = cur;
+  cur += size;
+  return p;
+}
+
+// frees memory from _dl_alloc, which must be given the size it was asked for
+extern "C" void _dl_free(void *p, size_t size) {
+  if (p == 0)
+    return;
+
+  if (size >= LARGE_MIN) {
+    size_t pagesz = _getauxval(AT_PAGESZ);
+    size = (size + pagesz - 1) & ~(pagesz - 1);
+    munmap(p, size);
+    _dl_arena_stats.used -= size;
+    _dl_arena_stats.reserved -= size;
+    return;
+  }
+
+  unsigned int i = size_class(&size);
+  _dl_arena_stats.used -= size;
+
+  free_block *block = (free_block *)p;
+  block->next = free_lists[i];
+  free_lists[i] = block;
+}
+
+extern "C" char *_dl_strndup(const char *s, size_t len) {
+  char *p = (char *)_dl_alloc(len + 1);
+  memcpy(p, s, len);
+  return p;
+}
+
+extern "C" char *_dl_strdup(const char *s) {
+  return _dl_strndup(s, strlen(s));
+}
@@ -0,0 +1,286 @@
+#include <sys/stat.h>
+
+#include "private.h"
+
+/*
+ * An opt-in cache of symbol bindings, for programs that are started over and
+ * over. With LD_BIND_CACHE=file, a start records which object and symbol each
+ * symbol index referenced by each object resolved to, and writes them out with
+ * the objects' build ids. Later starts that load the same objects, in the same
+ * order, replay the bindings instead of looking anything up. Bindings are
+ * indexes rather than addresses, so they hold across ASLR.
+ *
+ * A cache that doesn't match is rewritten after relocation. An object without
+ * a build id disables it, as nothing else identifies its contents cheaply.
+ * Only objects loaded at startup are covered.
+ */
+
+#define BIND_MAGIC "rtldbnd1"
+#define BUILD_ID_MAX 64
+// a weak reference that resolved to nothing
+#define BIND_WEAK 0xffffffff
+
+enum { CACHE_OFF, CACHE_REPLAY, CACHE_RECORD };
+
+struct bind_header {
+  char magic[8];
+  uint32_t count;
+  uint32_t reserved;
+};
+
+// one per object, followed by every object's bindings in order
+struct bind_object {
+  uint32_t build_id_len;
+  uint32_t nsyms;
+  uint8_t build_id[BUILD_ID_MAX];
+};
+
+static int state = CACHE_OFF;
+static const char *cache_path;
+static dl_object **objects;
+static size_t count;
+// the cache file, when replaying
+static const char *mapping;
+static size_t mapping_size;
+
+static const uint8_t *build_id(const dl_object *obj, uint32_t *len) {
+  for (size_t i = 0; i < obj->phnum; i++) {
+    const Elf64_Phdr *ph = &obj->phdr[i];
+    if (ph->p_type != PT_NOTE)
+      continue;
+
+    const char *p = (const char *)(obj->map.l_base + ph->p_vaddr);
+    const char *end = p + ph->p_memsz;
+    while (p + sizeof(Elf64_Nhdr) <= end) {
+      const Elf64_Nhdr *note = (const Elf64_Nhdr *)p;
+      const char *name = p + sizeof(Elf64_Nhdr);
+      const char *desc = name + ((note->n_namesz + 3) & ~3);
+      p = desc + ((note->n_descsz + 3) & ~3);
+
+      if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+          strncmp(name, "GNU", 4) == 0 && note->n_descsz <= BUILD_ID_MAX) {
+        *len = note->n_descsz;
+        return (const uint8_t *)desc;
+      }
+    }
+  }
+  return 0;
+}
+
+// one past the highest symbol index an object's relocations reference
+static uint32_t referenced_syms(const dl_object *obj) {
+  uint32_t n = 0;
+  for (size_t i = 0; i < obj->relacount; i++)
+    if (ELF64_R_SYM(obj->rela[i].r_info) >= n)
+      n = ELF64_R_SYM(obj->rela[i].r_info) + 1;
+  for (size_t i = 0; i < obj->jmprelcount; i++)
+    if (ELF64_R_SYM(obj->jmprel[i].r_info) >= n)
+      n = ELF64_R_SYM(obj->jmprel[i].r_info) + 1;
+  return n;
+}
+
+// the size of a cache file for the loaded objects
+static size_t cache_size() {
+  size_t size = sizeof(bind_header) + count * sizeof(bind_object);
+  for (size_t i = 0; i < count; i++)
+    size += objects[i]->bind_count * sizeof(dl_bind);
+  return size;
+}
+
+static bool matches(const dl_object *obj, const bind_object *entry) {
+  uint32_t len;
+  const uint8_t *id = build_id(obj, &len);
+  if (entry->build_id_len != len || entry->nsyms != obj->bind_count)
+    return false;
+  for (uint32_t i = 0; i < len; i++)
+    if (entry->build_id[i] != id[i])
+      return false;
+  return true;
+}
+
+// maps the cache file and points each object at its bindings, if it matches
+static bool replay() {
+  int fd = open(cache_path, O_RDONLY | O_CLOEXEC, 0);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  int ret = fstat(fd, &st);
+  if (ret < 0 || (size_t)st.st_size != cache_size()) {
+    close(fd);
+    return false;
+  }
+
+  uintptr_t addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr > -4096UL)
+    return false;
+  mapping = (const char *)addr;
+  mapping_size = st.st_size;
+
+  const bind_header *header = (const bind_header *)mapping;
+  const bind_object *entries = (const bind_object *)(header + 1);
+  bool valid = strncmp(header->magic, BIND_MAGIC, 8) == 0 &&
+               header->count == count;
+  for (size_t i = 0; valid && i < count; i++)
+    valid = matches(objects[i], &entries[i]);
+  if (!valid) {
+    munmap(addr, mapping_size);
+    mapping = 0;
+    return false;
+  }
+
+  dl_bind *binds = (dl_bind *)(entries + count);
+  for (size_t i = 0; i < count; i++) {
+    objects[i]->bind = binds;
+    binds += objects[i]->bind_count;
+  }
+  return true;
+}
+
+/*
+ * Replays the cache for the objects loaded at startup, or gets ready to record
+ * one if it doesn't match. Called before relocation.
+ */
+extern "C" void _dl_bind_cache_open() {
+  cache_path = _dl_getenv("LD_BIND_CACHE");
+  if (cache_path == 0 || cache_path[0] == 0 || _getauxval(AT_SECURE))
+    return;
+
+  for (struct link_map *lm = _dl_head; lm != 0; lm = lm->l_next)
+    count++;
+  objects = (dl_object **)_dl_alloc(count * sizeof(dl_object *));
+
+  size_t i = 0;
+  for (struct link_map *lm = _dl_head; lm != 0; lm = lm->l_next, i++) {
+    dl_object *obj = (dl_object *)lm;
+    uint32_t len;
+    if (build_id(obj, &len) == 0) {
+      _dl_free(objects, count * sizeof(dl_object *));
+      return;
+    }
+    objects[i] = obj;
+    obj->bind_index = i + 1;
+    obj->bind_count = referenced_syms(obj);
+  }
+
+  if (replay()) {
+    state = CACHE_REPLAY;
+    return;
+  }
+
+  state = CACHE_RECORD;
+  for (i = 0; i < count; i++)
+    objects[i]->bind =
+        (dl_bind *)_dl_alloc(objects[i]->bind_count * sizeof(dl_bind));
+}
+
+/*
+ * Looks up a binding for a symbol index of obj. Returns 1 with the symbol and
+ * the object defining it, -1 for a weak reference to nothing, or 0 if there is
+ * no binding.
+ */
+extern "C" int _dl_bind_replay(
+    const dl_object *obj, uint32_t index, const Elf64_Sym **sym,
+    dl_object **def) {
+  if (state != CACHE_REPLAY || index >= obj->bind_count)
+    return 0;
+
+  dl_bind bind = obj->bind[index];
+  if (bind.def == BIND_WEAK)
+    return -1;
+  if (bind.def == 0 || bind.def > count)
+    return 0;
+
+  *def = objects[bind.def - 1];
+  *sym = &(*def)->symtab[bind.sym];
+  return 1;
+}
+
+// records what a lookup found, which may race with the same lookup elsewhere
+extern "C" void _dl_bind_record(
+    dl_object *obj, uint32_t index, const Elf64_Sym *sym,
+    const dl_object *def) {
+  if (state != CACHE_RECORD || index >= obj->bind_count)
+    return;
+
+  dl_bind bind;
+  bind.def = sym != 0 ? def->bind_index : BIND_WEAK;
+  bind.sym = sym != 0 ? sym - def->symtab : 0;
+  obj->bind[index] = bind;
+}
+
+static bool write_all(int fd, const void *buf, size_t len) {
+  for (const char *p = (const char *)buf; len != 0;) {
+    long n = write(fd, p, len);
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+// writes the recorded cache next to its path, then renames it into place
+static void write_cache() {
+  char tmp[DL_PATH_MAX];
+  size_t len = strlen(cache_path);
+  if (len + 24 > sizeof(tmp))
+    return;
+  memcpy(tmp, cache_path, len);
+
+  // a temporary name per process, so concurrent starts don't collide
+  tmp[len++] = '.';
+  char digits[20];
+  size_t n = 0;
+  for (unsigned long pid = getpid(); pid != 0 || n == 0; pid /= 10)
+    digits[n++] = '0' + pid % 10;
+  while (n != 0)
+    tmp[len++] = digits[--n];
+  tmp[len] = 0;
+
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return;
+
+  bind_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BIND_MAGIC, 8);
+  header.count = count;
+  bool ok = write_all(fd, &header, sizeof(header));
+
+  for (size_t i = 0; ok && i < count; i++) {
+    bind_object entry;
+    memset(&entry, 0, sizeof(entry));
+    const uint8_t *id = build_id(objects[i], &entry.build_id_len);
+    memcpy(entry.build_id, id, entry.build_id_len);
+    entry.nsyms = objects[i]->bind_count;
+    ok = write_all(fd, &entry, sizeof(entry));
+  }
+  for (size_t i = 0; ok && i < count; i++)
+    ok = write_all(
+        fd, objects[i]->bind, objects[i]->bind_count * sizeof(dl_bind));
+
+  close(fd);
+  if (!ok || rename(tmp, cache_path) < 0)
+    unlink(tmp);
+}
+
+// writes a newly recorded cache, and drops the bindings, after relocation
+extern "C" void _dl_bind_cache_close() {
+  if (state == CACHE_OFF)
+    return;
+
+  if (state == CACHE_RECORD)
+    write_cache();
+
+  for (size_t i = 0; i < count; i++) {
+    if (state == CACHE_RECORD)
+      _dl_free(objects[i]->bind, objects[i]->bind_count * sizeof(dl_bind));
+    objects[i]->bind = 0;
+  }
+  if (mapping != 0)
+    munmap(mapping, mapping_size);
+  _dl_free(objects, count * sizeof(dl_object *));
+  state = CACHE_OFF;
+}
@@ -0,0 +1,87 @@
+#include "private.h"
+
+/*
+ * Libraries built for microarchitecture levels, see HWCAPS in
+ * share/mk/sys.lib.mk. Any search directory can have them in hwcaps/<level>
+ * beneath it, where they are looked for before the directory itself, best
+ * level first, skipping those the CPU can't run. The levels are worked out
+ * once, at startup.
+ *
+ * On x86_64 they are the psABI's x86-64-v2, v3 and v4. AT_HWCAP holds the
+ * baseline features (CPUID leaf 1's edx), cpuid the rest, and AVX and AVX-512
+ * only count if the kernel saves their registers, as XCR0 says.
+ */
+
+const char *_dl_hwcaps[DL_HWCAPS_MAX];
+int _dl_hwcaps_count;
+
+#if TARGET == x86_64
+// CPUID leaf 1, edx: FPU, CX8, CMOV, MMX, FXSR, SSE, SSE2
+#define BASELINE_EDX 0x07808101u
+// leaf 1, ecx: SSE3, SSSE3, CX16, SSE4.1, SSE4.2, POPCNT
+#define V2_ECX 0x00982201u
+// leaf 0x80000001, ecx: LAHF/SAHF
+#define V2_EXT_ECX 0x00000001u
+// leaf 1, ecx: FMA, MOVBE, OSXSAVE, AVX, F16C
+#define V3_ECX 0x38401000u
+// leaf 7, ebx: BMI1, AVX2, BMI2
+#define V3_EBX 0x00000128u
+// leaf 0x80000001, ecx: LZCNT
+#define V3_EXT_ECX 0x00000020u
+// leaf 7, ebx: AVX512F, AVX512DQ, AVX512CD, AVX512BW, AVX512VL
+#define V4_EBX 0xd0030000u
+// XCR0: SSE and AVX state, then opmask and the upper ZMM registers too
+#define V3_XCR0 0x06u
+#define V4_XCR0 0xe6u
+
+static void cpuid(unsigned leaf, unsigned *regs) {
+  __asm__("cpuid"
+          : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+          : "a"(leaf), "c"(0));
+}
+
+static bool has(unsigned reg, unsigned mask) {
+  return (reg & mask) == mask;
+}
+
+static int level() {
+  unsigned basic[4], leaf1[4], leaf7[4] = {0}, ext[4] = {0};
+  cpuid(0, basic);
+  if (basic[0] < 1)
+    return 1;
+  cpuid(1, leaf1);
+  if (basic[0] >= 7)
+    cpuid(7, leaf7);
+  cpuid(0x80000000, ext);
+  if (ext[0] >= 0x80000001)
+    cpuid(0x80000001, ext);
+  else
+    ext[2] = 0;
+
+  unsigned long hwcap = _getauxval(AT_HWCAP);
+  if (!has(hwcap != 0 ? hwcap : leaf1[3], BASELINE_EDX))
+    return 0;
+  if (!has(leaf1[2], V2_ECX) || !has(ext[2], V2_EXT_ECX))
+    return 1;
+
+  if (!has(leaf1[2], V3_ECX) || !has(leaf7[1], V3_EBX) ||
+      !has(ext[2], V3_EXT_ECX))
+    return 2;
+  unsigned xcr0, xcr0_hi;
+  __asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+  if (!has(xcr0, V3_XCR0))
+    return 2;
+
+  if (!has(leaf7[1], V4_EBX) || !has(xcr0, V4_XCR0))
+    return 3;
+  return 4;
+}
+
+extern "C" void _dl_hwcaps_init() {
+  static const char *const names[] = {"x86-64-v4", "x86-64-v3", "x86-64-v2"};
+  for (int l = level(); l >= 2; l--)
+    _dl_hwcaps[_dl_hwcaps_count++] = names[4 - l];
+}
+#else
+extern "C" void _dl_hwcaps_init() {}
+#endif
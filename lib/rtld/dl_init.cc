@@ -0,0 +1,110 @@
+#include "private.h"
+
+/*
+ * Initializers and finalizers. An object's DT_INIT and DT_INIT_ARRAY run
+ * after everything it depends on has been initialized, with the executable's
+ * DT_PREINIT_ARRAY before anything else, and each object is initialized once.
+ * Finalizers run in the reverse order: at exit, through the function _start
+ * hands the program in rdx for atexit(), and when dlclose() unloads an object.
+ * Either way libc's __cxa_finalize() first runs what was registered from the
+ * object, as C++ static destructors are.
+ *
+ * Both run with the loader lock held, which is recursive so they can call
+ * dlopen() and friends themselves. A deferred dependency (see dl_lazy.cc) is
+ * only initialized once it is loaded, by the first call that needs it.
+ */
+
+typedef void (*init_fn)(int, char **, char **);
+typedef void (*fini_fn)(void);
+
+// initialized objects, most recent first, which is the order to finalize in
+static dl_object *initialized;
+static int argc;
+static char **argv, **envp;
+
+// array entries of 0 and -1 are placeholders some linkers leave
+static bool callable(unsigned long fn) {
+  return fn != 0 && fn != -1UL;
+}
+
+static void run_array(const unsigned long *array, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    if (callable(array[i]))
+      ((init_fn)array[i])(argc, argv, envp);
+}
+
+// initializes an object's dependencies, then the object; cycles are cut where
+// the walk finds an object it has already started on
+static void init(dl_object *obj) {
+  if (obj->flags & DL_OBJ_INIT)
+    return;
+  obj->flags |= DL_OBJ_INIT;
+
+  for (dl_object_dep *dep = obj->dep; dep != 0; dep = dep->next)
+    init(dep->obj);
+
+  obj->fini_next = initialized;
+  initialized = obj;
+  if (callable(obj->init))
+    ((init_fn)obj->init)(argc, argv, envp);
+  run_array(obj->init_array, obj->init_count);
+}
+
+// initializes every loaded object that hasn't been, with the lock held
+extern "C" void _dl_init_all() {
+  for (struct link_map *lm = _dl_head; lm != 0; lm = lm->l_next)
+    init((dl_object *)lm);
+}
+
+// runs every initializer at startup, keeping the program's arguments for
+// those of objects loaded later
+extern "C" void _dl_init_start(int c, char **v, char **e) {
+  argc = c;
+  argv = v;
+  envp = e;
+
+  dl_object *exe = (dl_object *)_dl_head;
+  run_array(exe->preinit_array, exe->preinit_count);
+  _dl_init_all();
+}
+
+static void fini(dl_object *obj) {
+  for (size_t i = obj->fini_count; i != 0; i--)
+    if (callable(obj->fini_array[i - 1]))
+      ((fini_fn)obj->fini_array[i - 1])();
+  if (callable(obj->fini))
+    ((fini_fn)obj->fini)();
+}
+
+// runs what __cxa_atexit() registered from an object, then its finalizers
+static void finalize(dl_object *obj) {
+  // any address in the object identifies it to libc
+  dl_object *def;
+  const Elf64_Sym *sym = _dl_lookup("__cxa_finalize", 0, &def);
+  if (sym != 0 && ELF64_ST_TYPE(sym->st_info) == STT_FUNC)
+    ((void (*)(const void *))(def->map.l_base + sym->st_value))(obj->map.l_ld);
+  fini(obj);
+}
+
+// finalizes an object about to be unloaded, with the lock held
+extern "C" void _dl_fini_object(dl_object *obj) {
+  if (!(obj->flags & DL_OBJ_INIT))
+    return;
+
+  dl_object **p = &initialized;
+  while (*p != obj)
+    p = &(*p)->fini_next;
+  *p = obj->fini_next;
+  finalize(obj);
+}
+
+// finalizes everything still loaded, as the program exits
+extern "C" void _dl_fini() {
+  _dl_lock();
+  while (initialized != 0) {
+    dl_object *obj = initialized;
+    initialized = obj->fini_next;
+    finalize(obj);
+  }
+  _dl_unlock();
+}
@@ -0,0 +1,195 @@
+#include "private.h"
+
+/*
+ * Deferred loading of dependencies. A DT_NEEDED entry of an object loaded at
+ * startup is deferred when it follows a DT_POSFLAG_1 entry with
+ * DF_P1_LAZYLOAD (-z lazyload), or when LD_LAZYLOAD=name[,name...] names it.
+ * Nothing is mapped for it then, and calls through the PLT that nothing
+ * loaded resolves are bound when first made instead: their JUMP_SLOT entries
+ * are left pointing at the lazy binding stubs, with GOT[1] and GOT[2] set to
+ * the object and _dl_lazy_plt, see x86_64/_lazy.S. The first such call loads
+ * the object's deferred dependencies one at a time, in order, until one of
+ * them defines the symbol, then relocates and initializes them and binds the
+ * slot, so their initializers run then rather than at startup.
+ *
+ * Only calls can wait. An object whose other relocations need something only
+ * a deferred dependency can define, or without lazy binding stubs, has its
+ * deferred dependencies loaded at startup after all.
+ *
+ * Symbols are bound in the global scope as it is when they are looked up, so
+ * one defined both by a deferred dependency and by something loaded later in
+ * the chain may bind to the latter.
+ */
+
+struct dl_deferred {
+  dl_deferred *next;
+  // points into the requesting object's string table
+  const char *name;
+
+  void *operator new(unsigned long);
+};
+
+void *dl_deferred::operator new(unsigned long size) {
+  return _dl_alloc(size);
+}
+
+static const char *names;
+
+extern "C" void _dl_lazy_init() {
+  names = _dl_getenv("LD_LAZYLOAD");
+  if (names != 0 && (names[0] == 0 || _getauxval(AT_SECURE)))
+    names = 0;
+}
+
+// whether a DT_NEEDED entry can wait, given the DT_POSFLAG_1 entry before it
+extern "C" int _dl_lazy_wanted(const char *name, unsigned long posflag) {
+  if (posflag & DF_P1_LAZYLOAD)
+    return 1;
+  return names != 0 && _dl_list_find(names, name, strlen(name)) != 0;
+}
+
+// records a DT_NEEDED entry to load when it is first needed
+extern "C" void _dl_lazy_defer(dl_object *obj, const char *name) {
+  dl_deferred *d = new dl_deferred;
+  d->name = name;
+  dl_deferred **tail = &obj->deferred;
+  while (*tail != 0)
+    tail = &(*tail)->next;
+  *tail = d;
+}
+
+static const Elf64_Sym *
+find(const char *name, dl_object *obj, dl_object **def) {
+  const Elf64_Sym *sym = _dl_lookup(name, 0, def);
+  if (sym == 0 && !(obj->flags & DL_OBJ_GLOBAL))
+    sym = _dl_lookup_tree(name, obj, def);
+  return sym;
+}
+
+/*
+ * Loads an object's first deferred dependency and everything it needs, which
+ * join the global scope. Once the program is running they are also relocated.
+ */
+static void load_next(dl_object *obj, bool running) {
+  dl_deferred *d = obj->deferred;
+  obj->deferred = d->next;
+
+  if (running) {
+    _r_debug.r_state = r_debug::RT_ADD;
+    _dl_debug_state();
+  }
+
+  struct link_map *tail = _dl_tail;
+  obj->add_dependency(dl_object::load(d->name, obj));
+  for (struct link_map *lm = tail->l_next; lm != 0; lm = lm->l_next) {
+    dl_object *dep = (dl_object *)lm;
+    dep->flags |= DL_OBJ_GLOBAL | DL_OBJ_NODELETE;
+    dep->parse_dynamic();
+    dep->load_needed(false);
+  }
+  _dl_free(d, sizeof(dl_deferred));
+
+  if (running) {
+    if (_dl_tail != tail) {
+      _dl_tls_load(tail->l_next);
+      _dl_relocate_all(0);
+      _dl_phdr_publish();
+    }
+    _r_debug.r_state = r_debug::RT_CONSISTENT;
+    _dl_debug_state();
+  }
+}
+
+// whether any relocation but a call needs a deferred dependency already
+static bool needs_deferred(dl_object *obj) {
+  for (size_t i = 0; i < obj->jmprelcount; i++) {
+    unsigned long *where =
+        (unsigned long *)(obj->map.l_base + obj->jmprel[i].r_offset);
+    if (*where == 0)
+      return true;
+  }
+
+  for (size_t i = 0; i < obj->relacount; i++) {
+    const Elf64_Rela *rela = &obj->rela[i];
+    switch (ELF64_R_TYPE(rela->r_info)) {
+    case R_TARGET_NONE:
+    case R_TARGET_RELATIVE:
+    case R_TARGET_IRELATIVE:
+      continue;
+    }
+
+    const Elf64_Sym *ref = &obj->symtab[ELF64_R_SYM(rela->r_info)];
+    if (ELF64_ST_BIND(ref->st_info) != STB_GLOBAL)
+      continue;
+    // a COPY relocation's source is never the object itself
+    const char *name = obj->strtab + ref->st_name;
+    dl_object *def;
+    const Elf64_Sym *sym = ELF64_R_TYPE(rela->r_info) == R_TARGET_COPY
+                               ? _dl_lookup(name, obj, &def)
+                               : find(name, obj, &def);
+    if (sym == 0)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Decides, before relocation at startup, which deferred dependencies have to
+ * be loaded now, and points the GOT of objects that still have some at
+ * _dl_lazy_plt.
+ */
+extern "C" void _dl_lazy_prepare() {
+  for (struct link_map *lm = _dl_head; lm != 0; lm = lm->l_next) {
+    dl_object *obj = (dl_object *)lm;
+    if (obj->deferred == 0)
+      continue;
+
+    if (obj->pltgot == 0 || needs_deferred(obj)) {
+      while (obj->deferred != 0)
+        load_next(obj, false);
+      continue;
+    }
+
+    obj->pltgot[1] = (unsigned long)obj;
+    obj->pltgot[2] = (unsigned long)_dl_lazy_plt;
+  }
+}
+
+/*
+ * Binds a JUMP_SLOT of an object with deferred dependencies, loading them until
+ * one defines the symbol. Returns where the call goes.
+ */
+extern "C" unsigned long
+_dl_lazy_resolve(dl_object *obj, unsigned long index) {
+  const Elf64_Rela *rela = &obj->jmprel[index];
+  const Elf64_Sym *ref = &obj->symtab[ELF64_R_SYM(rela->r_info)];
+  const char *name = obj->strtab + ref->st_name;
+  dl_object *def;
+
+  _dl_lock();
+  const Elf64_Sym *sym = find(name, obj, &def);
+  while (sym == 0 && obj->deferred != 0) {
+    load_next(obj, true);
+    sym = find(name, obj, &def);
+  }
+  if (sym == 0)
+    _dl_fatal("undefined symbol", name);
+
+  unsigned long value = def->map.l_base + sym->st_value;
+  if (ELF64_ST_TYPE(sym->st_info) == STT_GNU_IFUNC)
+    value = ((unsigned long (*)(void))value)();
+
+  // with -z now, the slot is in the read-only RELRO segment
+  unsigned long where = obj->map.l_base + rela->r_offset;
+  bool relro = where >= obj->relro_start && where < obj->relro_end;
+  unsigned long page = where & -_getauxval(AT_PAGESZ);
+  if (relro)
+    mprotect(page, _getauxval(AT_PAGESZ), PROT_READ | PROT_WRITE);
+  __atomic_store_n((unsigned long *)where, value, __ATOMIC_RELAXED);
+  if (relro)
+    mprotect(page, _getauxval(AT_PAGESZ), PROT_READ);
+  _dl_init_all();
+  _dl_unlock();
+
+  return value;
+}
@@ -1,15 +1,621 @@
+#include <sys/stat.h>
+
 #include "private.h"
 
-dl_pool<sizeof(dl_object)> _dl_object_pool;
-dl_pool<sizeof(dl_object_dep)> _dl_object_dep_pool;
+struct link_map *_dl_head, *_dl_tail;
+
+// cleared by LD_PREFETCH=0
+int _dl_prefetch = 1;
+// cleared by LD_HUGEPAGE=0
+int _dl_hugepage = 1;
+
+unsigned long long _dl_adds, _dl_subs;
 
-void *dl_object::operator new(unsigned long) {
-    return _dl_object_pool.alloc();
+// the descriptor load() is mapping from, if any
+static int loading_fd = -1;
+// the latest scope() list
+static unsigned long scope_generation;
+
+void *dl_object::operator new(unsigned long size) {
+    return _dl_alloc(size);
 }
+// dependencies are kept in DT_NEEDED order, which lookups follow
 void dl_object::add_dependency(dl_object *dep) {
-    this->dep = new dl_object_dep(this->dep, dep);
+    dl_object_dep **tail = &this->dep;
+    while (*tail != 0)
+      tail = &(*tail)->next;
+    *tail = new dl_object_dep(0, dep);
+    dep->refcount++;
+}
+
+void *dl_object_dep::operator new(unsigned long size) {
+    return _dl_alloc(size);
+}
+
+static void append(dl_object *obj) {
+  _dl_adds++;
+  obj->map.l_next = 0;
+  obj->map.l_prev = _dl_tail;
+  if (_dl_tail != 0)
+    _dl_tail->l_next = &obj->map;
+  else
+    _dl_head = &obj->map;
+  _dl_tail = &obj->map;
+}
+
+static void detach(dl_object *obj) {
+  if (obj->map.l_prev != 0)
+    obj->map.l_prev->l_next = obj->map.l_next;
+  else
+    _dl_head = obj->map.l_next;
+  if (obj->map.l_next != 0)
+    obj->map.l_next->l_prev = obj->map.l_prev;
+  else
+    _dl_tail = obj->map.l_prev;
+}
+
+/*
+ * Executable segments at least this large are placed for transparent huge
+ * pages. The kernel only backs file pages with huge pages where the mapping's
+ * address and file offset are 2 MiB aligned together, so this only helps
+ * segments whose address and offset agree modulo 2 MiB. Linkers only promise
+ * that modulo the page size unless asked, as with -z max-page-size=0x200000.
+ */
+#define HUGEPAGE_SIZE 0x200000
+
+static bool large_text(const Elf64_Phdr *ph) {
+  return ph->p_type == PT_LOAD && (ph->p_flags & PF_X) &&
+         ph->p_filesz >= HUGEPAGE_SIZE &&
+         (ph->p_vaddr - ph->p_offset) % HUGEPAGE_SIZE == 0;
+}
+
+static int segment_prot(const Elf64_Phdr *ph) {
+  return ((ph->p_flags & PF_R) ? PROT_READ : 0) |
+         ((ph->p_flags & PF_W) ? PROT_WRITE : 0) |
+         ((ph->p_flags & PF_X) ? PROT_EXEC : 0);
+}
+
+dl_object *dl_object::from_image(
+    unsigned long base, const Elf64_Phdr *phdr, size_t phnum,
+    const char *name) {
+  dl_object *obj = new dl_object;
+  obj->map.l_base = base;
+  obj->map.l_name = name;
+  obj->phdr = phdr;
+  obj->phnum = phnum;
+
+  size_t pagesz = _getauxval(AT_PAGESZ);
+  for (size_t i = 0; i < phnum; i++) {
+    switch (phdr[i].p_type) {
+    case PT_DYNAMIC:
+      obj->map.l_ld = (const void *)(base + phdr[i].p_vaddr);
+      break;
+    case PT_TLS:
+      obj->tls_image = (const char *)(base + phdr[i].p_vaddr);
+      obj->tls_filesz = phdr[i].p_filesz;
+      obj->tls_memsz = phdr[i].p_memsz;
+      obj->tls_align = phdr[i].p_align != 0 ? phdr[i].p_align : 1;
+      break;
+    case PT_GNU_RELRO:
+      // only whole pages can be protected, so round the end down
+      obj->relro_start = (base + phdr[i].p_vaddr) & ~(pagesz - 1);
+      obj->relro_end =
+          (base + phdr[i].p_vaddr + phdr[i].p_memsz) & ~(pagesz - 1);
+      break;
+    }
+  }
+
+  append(obj);
+  return obj;
+}
+
+dl_object *dl_object::map_file(int fd, const char *name) {
+  // the ELF header and program headers almost always fit in the first read
+  union {
+    Elf64_Ehdr ehdr;
+    char buf[0x400];
+  } head;
+  long n = pread(fd, &head, sizeof(head), 0);
+  Elf64_Ehdr *ehdr = &head.ehdr;
+  if (n < (long)sizeof(Elf64_Ehdr) ||
+      strncmp((const char *)ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+      ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_type != ET_DYN ||
+      ehdr->e_machine != EM_TARGET ||
+      ehdr->e_phentsize != sizeof(Elf64_Phdr))
+    _dl_fatal("not a loadable shared object", name);
+
+  Elf64_Phdr phbuf[DL_MAX_PHDR];
+  const Elf64_Phdr *phdr = (const Elf64_Phdr *)(head.buf + ehdr->e_phoff);
+  size_t phsize = ehdr->e_phnum * sizeof(Elf64_Phdr);
+  if (ehdr->e_phoff + phsize > (unsigned long)n) {
+    if (ehdr->e_phnum > DL_MAX_PHDR ||
+        pread(fd, phbuf, phsize, ehdr->e_phoff) != (long)phsize)
+      _dl_fatal("cannot read program headers", name);
+    phdr = phbuf;
+  }
+
+  size_t pagesz = _getauxval(AT_PAGESZ);
+  uintptr_t lo = -1UL, hi = 0;
+  for (size_t i = 0; i < ehdr->e_phnum; i++) {
+    if (phdr[i].p_type != PT_LOAD)
+      continue;
+    uintptr_t start = phdr[i].p_vaddr & ~(pagesz - 1);
+    uintptr_t end = (phdr[i].p_vaddr + phdr[i].p_memsz + pagesz - 1) &
+                    ~(pagesz - 1);
+    if (start < lo)
+      lo = start;
+    if (end > hi)
+      hi = end;
+  }
+  if (hi == 0)
+    _dl_fatal("no loadable segments", name);
+
+  /*
+   * Start reading the segments in now. Mapping itself reads nothing, but two
+   * pages are touched right after it, below: the one holding the program
+   * headers, which from_image() reads through the mapping, and the last file
+   * page of a segment with .bss, whose tail is zeroed. Those faults may wait
+   * on this read. Everything else, the dynamic section included, is left
+   * until this object's siblings have been found and mapped, so their reads
+   * overlap.
+   */
+  if (_dl_prefetch) {
+    unsigned long off_lo = -1UL, off_hi = 0;
+    for (size_t i = 0; i < ehdr->e_phnum; i++) {
+      if (phdr[i].p_type != PT_LOAD)
+        continue;
+      if (phdr[i].p_offset < off_lo)
+        off_lo = phdr[i].p_offset;
+      if (phdr[i].p_offset + phdr[i].p_filesz > off_hi)
+        off_hi = phdr[i].p_offset + phdr[i].p_filesz;
+    }
+    readahead(fd, off_lo, off_hi - off_lo);
+  }
+
+  /*
+   * Reserve the whole span first, so segments can be placed with MAP_FIXED.
+   * With large text linked for it (see large_text()), the base is 2 MiB
+   * aligned, so that the kernel can back the text with huge pages.
+   */
+  size_t align = pagesz;
+  for (size_t i = 0; _dl_hugepage && i < ehdr->e_phnum; i++)
+    if (large_text(&phdr[i]))
+      align = HUGEPAGE_SIZE;
+
+  size_t len = hi - lo + align - pagesz;
+  uintptr_t reserved =
+      mmap(0, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (reserved > -4096UL)
+    _dl_fatal("cannot map", name);
+  uintptr_t base = (reserved - lo + align - 1) & ~(uintptr_t)(align - 1);
+  uintptr_t region = base + lo;
+  // trim the slack on either side
+  if (region != reserved)
+    munmap(reserved, region - reserved);
+  if (region + (hi - lo) != reserved + len)
+    munmap(region + (hi - lo), reserved + len - region - (hi - lo));
+
+  const Elf64_Phdr *phdr_seg = 0;
+  for (size_t i = 0; i < ehdr->e_phnum; i++) {
+    const Elf64_Phdr *ph = &phdr[i];
+    if (ph->p_type == PT_PHDR)
+      phdr_seg = ph;
+    if (ph->p_type != PT_LOAD)
+      continue;
+
+    int prot = segment_prot(ph);
+    uintptr_t start = ph->p_vaddr & ~(pagesz - 1);
+    uintptr_t file_end = ph->p_vaddr + ph->p_filesz;
+    uintptr_t mem_end =
+        (ph->p_vaddr + ph->p_memsz + pagesz - 1) & ~(pagesz - 1);
+
+    if (ph->p_filesz != 0) {
+      uintptr_t addr = mmap(
+          base + start, file_end - start, prot, MAP_PRIVATE | MAP_FIXED, fd,
+          ph->p_offset & ~(pagesz - 1));
+      if (addr > -4096UL) {
+        munmap(region, hi - lo);
+        _dl_fatal("cannot map segment", name);
+      }
+    }
+
+    if (ph->p_memsz > ph->p_filesz) {
+      // the tail of the last file page belongs to .bss
+      uintptr_t zero_end = (file_end + pagesz - 1) & ~(pagesz - 1);
+      if (ph->p_filesz != 0 && (prot & PROT_WRITE))
+        memset((void *)(base + file_end), 0, zero_end - file_end);
+      if (ph->p_filesz == 0)
+        zero_end = start;
+
+      if (mem_end > zero_end) {
+        uintptr_t addr = mmap(
+            base + zero_end, mem_end - zero_end, prot,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        if (addr > -4096UL) {
+          munmap(region, hi - lo);
+          _dl_fatal("cannot map segment", name);
+        }
+      }
+    }
+
+    // without PT_PHDR, find the program headers in the segment mapping them
+    if (phdr_seg == 0 && ph->p_offset <= ehdr->e_phoff &&
+        ehdr->e_phoff + phsize <= ph->p_offset + ph->p_filesz)
+      phdr_seg = ph;
+  }
+  if (phdr_seg == 0) {
+    munmap(region, hi - lo);
+    _dl_fatal("program headers are not mapped", name);
+  }
+
+  uintptr_t phdr_addr = (phdr_seg->p_type == PT_PHDR)
+                            ? base + phdr_seg->p_vaddr
+                            : base + phdr_seg->p_vaddr +
+                                  (ehdr->e_phoff - phdr_seg->p_offset);
+  dl_object *obj = from_image(
+      base, (const Elf64_Phdr *)phdr_addr, ehdr->e_phnum, name);
+  obj->map_start = region;
+  obj->map_size = hi - lo;
+  obj->advise_hugepage();
+  return obj;
 }
 
-void *dl_object_dep::operator new(unsigned long) {
-    return _dl_object_dep_pool.alloc();
+/*
+ * Finds the object a name refers to, loading it if it isn't already. Library
+ * directories come from the requesting object's DT_RPATH and DT_RUNPATH, if
+ * there is one. New objects are appended to the link_map chain, but their
+ * dynamic sections are left for the caller to parse.
+ */
+dl_object *dl_object::load(const char *name, dl_object *requester) {
+  dl_object *obj = _dl_find_name(name);
+  if (obj != 0)
+    return obj;
+
+  dl_search_path *rpath_dirs = 0, *runpath_dirs = 0;
+  if (requester != 0) {
+    if (requester->rpath != 0 && requester->rpath_dirs == 0)
+      requester->rpath_dirs = _dl_search_path_parse(requester->rpath);
+    if (requester->runpath != 0 && requester->runpath_dirs == 0)
+      requester->runpath_dirs = _dl_search_path_parse(requester->runpath);
+    rpath_dirs = requester->rpath_dirs;
+    runpath_dirs = requester->runpath_dirs;
+  }
+
+  char path[DL_PATH_MAX];
+  unsigned long long t = dl_stats_begin();
+  int fd = _dl_search_library(name, rpath_dirs, runpath_dirs, path);
+  dl_stats_end(&_dl_stats.phase[DL_PHASE_SEARCH], t);
+  if (fd < 0)
+    _dl_fatal("cannot find library", name);
+
+  // the name may be new, but the file could still be loaded already
+  struct stat st;
+  int ret = fstat(fd, &st);
+  expect(ret);
+  obj = _dl_find_file(st.st_dev, st.st_ino);
+  if (obj == 0) {
+    // a failed map unwinds past the close below, so rollback() closes it
+    loading_fd = fd;
+    t = dl_stats_begin();
+    obj = map_file(fd, _dl_strdup(path));
+    dl_stats_end(&_dl_stats.phase[DL_PHASE_MAP], t);
+    dl_stats_count(&_dl_stats.maps, 1);
+    loading_fd = -1;
+    obj->dev = st.st_dev;
+    obj->ino = st.st_ino;
+    _dl_register(obj);
+  }
+  close(fd);
+  return obj;
+}
+
+dl_object *dl_object::containing(unsigned long addr) {
+  for (struct link_map *lm = _dl_head; lm != 0; lm = lm->l_next) {
+    dl_object *obj = (dl_object *)lm;
+    for (size_t i = 0; i < obj->phnum; i++) {
+      const Elf64_Phdr *ph = &obj->phdr[i];
+      unsigned long start = obj->map.l_base + ph->p_vaddr;
+      if (ph->p_type == PT_LOAD && addr >= start && addr < start + ph->p_memsz)
+        return obj;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Asks the kernel to start reading in an image it mapped itself, like the
+ * executable, whose pages are otherwise faulted in one at a time.
+ */
+void dl_object::prefetch() {
+  if (!_dl_prefetch)
+    return;
+
+  size_t pagesz = _getauxval(AT_PAGESZ);
+  for (size_t i = 0; i < this->phnum; i++) {
+    const Elf64_Phdr *ph = &this->phdr[i];
+    if (ph->p_type != PT_LOAD || ph->p_filesz == 0)
+      continue;
+
+    uintptr_t start = (this->map.l_base + ph->p_vaddr) & ~(pagesz - 1);
+    uintptr_t end = this->map.l_base + ph->p_vaddr + ph->p_filesz;
+    madvise(start, end - start, MADV_WILLNEED);
+  }
+}
+
+// asks for huge pages for the aligned middle of large text segments
+void dl_object::advise_hugepage() {
+  if (!_dl_hugepage)
+    return;
+
+  for (size_t i = 0; i < this->phnum; i++) {
+    const Elf64_Phdr *ph = &this->phdr[i];
+    if (!large_text(ph))
+      continue;
+
+    uintptr_t start = (this->map.l_base + ph->p_vaddr + HUGEPAGE_SIZE - 1) &
+                      ~(uintptr_t)(HUGEPAGE_SIZE - 1);
+    uintptr_t end = (this->map.l_base + ph->p_vaddr + ph->p_filesz) &
+                    ~(uintptr_t)(HUGEPAGE_SIZE - 1);
+    if (end > start)
+      madvise(start, end - start, MADV_HUGEPAGE);
+  }
+}
+
+void dl_object::parse_dynamic() {
+  const Elf64_Dyn *dyn = (const Elf64_Dyn *)this->map.l_ld;
+  if (dyn == 0)
+    return;
+
+  unsigned long base = this->map.l_base;
+  unsigned long rpath = 0, runpath = 0, soname = 0;
+  bool has_rpath = false, has_runpath = false, has_soname = false;
+  const Elf64_Word *gnu_hash = 0;
+  for (; dyn->d_tag != DT_NULL; dyn++) {
+    switch (dyn->d_tag) {
+    case DT_STRTAB:
+      this->strtab = (const char *)(base + dyn->d_un.d_ptr);
+      break;
+    case DT_SYMTAB:
+      this->symtab = (const Elf64_Sym *)(base + dyn->d_un.d_ptr);
+      break;
+    case DT_VERSYM:
+      this->versym = (const Elf64_Half *)(base + dyn->d_un.d_ptr);
+      break;
+    case DT_HASH:
+      this->hash = (const Elf64_Word *)(base + dyn->d_un.d_ptr);
+      break;
+    case DT_GNU_HASH:
+      gnu_hash = (const Elf64_Word *)(base + dyn->d_un.d_ptr);
+      break;
+    case DT_RELA:
+      this->rela = (const Elf64_Rela *)(base + dyn->d_un.d_ptr);
+      break;
+    case DT_RELASZ:
+      this->relacount = dyn->d_un.d_val / sizeof(Elf64_Rela);
+      break;
+    case DT_JMPREL:
+      this->jmprel = (const Elf64_Rela *)(base + dyn->d_un.d_ptr);
+      break;
+    case DT_PLTRELSZ:
+      this->jmprelcount = dyn->d_un.d_val / sizeof(Elf64_Rela);
+      break;
+    case DT_RELR:
+      this->relr = (const Elf64_Relr *)(base + dyn->d_un.d_ptr);
+      break;
+    case DT_RELRSZ:
+      this->relrcount = dyn->d_un.d_val / sizeof(Elf64_Relr);
+      break;
+    case DT_PLTGOT:
+      this->pltgot = (unsigned long *)(base + dyn->d_un.d_ptr);
+      break;
+    case DT_INIT:
+      this->init = base + dyn->d_un.d_ptr;
+      break;
+    case DT_FINI:
+      this->fini = base + dyn->d_un.d_ptr;
+      break;
+    case DT_INIT_ARRAY:
+      this->init_array = (const unsigned long *)(base + dyn->d_un.d_ptr);
+      break;
+    case DT_INIT_ARRAYSZ:
+      this->init_count = dyn->d_un.d_val / sizeof(unsigned long);
+      break;
+    case DT_FINI_ARRAY:
+      this->fini_array = (const unsigned long *)(base + dyn->d_un.d_ptr);
+      break;
+    case DT_FINI_ARRAYSZ:
+      this->fini_count = dyn->d_un.d_val / sizeof(unsigned long);
+      break;
+    case DT_PREINIT_ARRAY:
+      this->preinit_array = (const unsigned long *)(base + dyn->d_un.d_ptr);
+      break;
+    case DT_PREINIT_ARRAYSZ:
+      this->preinit_count = dyn->d_un.d_val / sizeof(unsigned long);
+      break;
+    case DT_SYMINFO:
+      this->syminfo = (const Elf64_Syminfo *)(base + dyn->d_un.d_ptr);
+      break;
+    case DT_SYMINSZ:
+      this->syminfo_count = dyn->d_un.d_val / sizeof(Elf64_Syminfo);
+      break;
+    case DT_RPATH:
+      rpath = dyn->d_un.d_val;
+      has_rpath = true;
+      break;
+    case DT_RUNPATH:
+      runpath = dyn->d_un.d_val;
+      has_runpath = true;
+      break;
+    case DT_SONAME:
+      soname = dyn->d_un.d_val;
+      has_soname = true;
+      break;
+    }
+  }
+
+  /*
+   * DT_GNU_HASH is a header of four words, the bloom filter, the buckets,
+   * then the hash chains, which are indexed from the first hashed symbol.
+   */
+  if (gnu_hash != 0) {
+    this->gnu_nbuckets = gnu_hash[0];
+    this->gnu_symoffset = gnu_hash[1];
+    this->gnu_bloom_size = gnu_hash[2];
+    this->gnu_bloom_shift = gnu_hash[3];
+    this->gnu_bloom = (const Elf64_Addr *)(gnu_hash + 4);
+    this->gnu_buckets =
+        (const Elf64_Word *)(this->gnu_bloom + this->gnu_bloom_size);
+    this->gnu_chain =
+        this->gnu_buckets + this->gnu_nbuckets - this->gnu_symoffset;
+  }
+
+  // string offsets can only be resolved once DT_STRTAB is known
+  if (has_rpath)
+    this->rpath = this->strtab + rpath;
+  if (has_runpath)
+    this->runpath = this->strtab + runpath;
+  if (has_soname) {
+    this->soname = this->strtab + soname;
+    _dl_register_soname(this);
+  }
+}
+
+/*
+ * Finds, maps and records every DT_NEEDED entry of this object. New objects
+ * are appended to the link_map chain, which the caller walks, so dependencies
+ * are loaded breadth first. They are only parsed when the walk reaches them,
+ * by which point the reads started while mapping them have had time to run.
+ */
+void dl_object::load_needed(bool lazy) {
+  const Elf64_Dyn *dyn = (const Elf64_Dyn *)this->map.l_ld;
+  if (dyn == 0)
+    return;
+
+  // direct bindings name DT_NEEDED entries by their index
+  const Elf64_Dyn *start = dyn;
+  if (this->syminfo != 0 && _dl_direct) {
+    while (dyn->d_tag != DT_NULL)
+      dyn++;
+    this->bound_count = dyn - start;
+    this->bound =
+        (dl_object **)_dl_alloc(this->bound_count * sizeof(dl_object *));
+    dyn = start;
+  }
+
+  // DT_POSFLAG_1 applies to the DT_NEEDED entry right after it
+  unsigned long posflag = 0;
+  for (; dyn->d_tag != DT_NULL; dyn++) {
+    if (dyn->d_tag == DT_POSFLAG_1) {
+      posflag = dyn->d_un.d_val;
+      continue;
+    }
+    if (dyn->d_tag != DT_NEEDED)
+      continue;
+
+    const char *name = this->strtab + dyn->d_un.d_val;
+    if (lazy && _dl_find_name(name) == 0 && _dl_lazy_wanted(name, posflag)) {
+      _dl_lazy_defer(this, name);
+    } else {
+      dl_object *obj = load(name, this);
+      add_dependency(obj);
+      if (this->bound != 0)
+        this->bound[dyn - start] = obj;
+    }
+    posflag = 0;
+  }
+}
+
+/*
+ * Links this object and everything it depends on through scope_next, breadth
+ * first in DT_NEEDED order, and returns the head of the list. The list is only
+ * valid until the next call, so callers hold the loader lock.
+ */
+dl_object *dl_object::scope() {
+  unsigned long gen = ++scope_generation;
+  dl_object *tail = this;
+  this->scope_gen = gen;
+  this->scope_next = 0;
+
+  for (dl_object *obj = this; obj != 0; obj = obj->scope_next) {
+    for (dl_object_dep *dep = obj->dep; dep != 0; dep = dep->next) {
+      if (dep->obj->scope_gen == gen)
+        continue;
+      dep->obj->scope_gen = gen;
+      dep->obj->scope_next = 0;
+      tail->scope_next = dep->obj;
+      tail = dep->obj;
+    }
+  }
+
+  return this;
+}
+
+/*
+ * Drops a reference, unloading the object and releasing its dependencies when
+ * it was the last. Objects that depend on each other keep each other loaded.
+ * It is finalized before anything it depends on.
+ */
+void dl_object::release() {
+  if (--this->refcount != 0 || (this->flags & DL_OBJ_NODELETE))
+    return;
+
+  _dl_fini_object(this);
+  for (dl_object_dep *dep = this->dep; dep != 0; dep = dep->next)
+    dep->obj->release();
+  destroy();
+}
+
+// unmaps an object and frees everything it owns, without touching its
+// dependencies
+void dl_object::destroy() {
+  detach(this);
+  _dl_unregister(this);
+  _dl_tls_unload(this);
+  _dl_profile_unload(this);
+  _dl_subs++;
+  // unwinders may still be reading its program headers, and its name
+  bool published = this->flags & DL_OBJ_PUBLISHED;
+
+  for (dl_object_dep *dep = this->dep, *next; dep != 0; dep = next) {
+    next = dep->next;
+    _dl_free(dep, sizeof(dl_object_dep));
+  }
+  if (this->memo != 0)
+    _dl_free(this->memo, (this->memo_mask + 1) * sizeof(dl_sym_memo));
+  _dl_free(this->bound, this->bound_count * sizeof(dl_object *));
+
+  // only objects map_file() created own their mapping and name
+  if (this->map_size != 0 && published) {
+    _dl_phdr_retire((void *)this->map_start, this->map_size, true);
+    _dl_phdr_retire(
+        (void *)this->map.l_name, strlen(this->map.l_name) + 1, false);
+  } else if (this->map_size != 0) {
+    munmap(this->map_start, this->map_size);
+    _dl_free((void *)this->map.l_name, strlen(this->map.l_name) + 1);
+  }
+  _dl_free(this, sizeof(dl_object));
+  if (published)
+    _dl_phdr_publish();
+}
+
+/*
+ * Unloads every object loaded after tail, after a failed dlopen(). Their
+ * references to older objects are dropped, but older objects are otherwise
+ * untouched, as nothing they use was loaded yet.
+ */
+extern "C" void _dl_rollback(struct link_map *tail) {
+  if (loading_fd >= 0) {
+    close(loading_fd);
+    loading_fd = -1;
+  }
+
+  struct link_map *first = tail != 0 ? tail->l_next : _dl_head;
+  for (struct link_map *lm = first; lm != 0; lm = lm->l_next) {
+    dl_object *obj = (dl_object *)lm;
+    for (dl_object_dep *dep = obj->dep; dep != 0; dep = dep->next)
+      dep->obj->refcount--;
+  }
+
+  while (_dl_tail != tail)
+    ((dl_object *)_dl_tail)->destroy();
 }
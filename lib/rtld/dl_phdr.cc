@@ -0,0 +1,166 @@
+#include "private.h"
+
+/*
+ * dl_iterate_phdr() is called by unwinders for every exception thrown, from
+ * any number of threads at once, so it never takes the loader lock. Instead,
+ * the loader publishes an immutable snapshot of every object's program headers
+ * whenever the set of objects changes, and readers walk whichever snapshot is
+ * current.
+ *
+ * Old snapshots, and the mappings and names of objects being unloaded, are
+ * only freed once no reader can still be using them. Readers announce
+ * themselves in one of two groups of counters, picked by the low bit of the
+ * epoch. A writer publishes the new snapshot, bumps the epoch, and retires
+ * what the old snapshot referred to to the old group; a reader that
+ * registered in the old group after the bump sees the epoch change and
+ * registers again in the new one. Each group is striped over separate cache
+ * lines, picked by a hash of the thread's TCB address, so readers on
+ * different threads rarely touch the same line.
+ *
+ * Publishing never waits: whatever is retired is freed by the first publish
+ * to find its group empty, which is usually the one that retired it. So a
+ * callback can dlopen(), dlclose() or call into a deferred library, all of
+ * which publish.
+ */
+
+#define STRIPE_BITS 4
+#define STRIPES (1 << STRIPE_BITS)
+
+struct dl_phdr_snapshot {
+  size_t size, count;
+  dl_phdr_info info[];
+};
+
+struct __aligned(64) reader_count {
+  unsigned long count;
+};
+
+// what readers may still see, freed once its group has drained
+struct retired {
+  retired *next;
+  unsigned long group;
+  void *addr;
+  size_t size;
+  // a mapping to unmap rather than an arena allocation
+  bool mapped;
+};
+
+static dl_phdr_snapshot *current;
+static unsigned long epoch;
+static reader_count readers[2][STRIPES];
+// retired by the next publish, then waiting on their group
+static retired *pending, *waiting;
+
+/*
+ * TCBs, like stacks, are often a power of two apart, so their low bits say
+ * little; a multiplicative hash mixes them all into the top bits.
+ */
+static unsigned int stripe() {
+  return ((uintptr_t)dl_tcb_self() * 0x9e3779b97f4a7c15UL) >>
+         (64 - STRIPE_BITS);
+}
+
+static bool drained(unsigned long group) {
+  for (unsigned int i = 0; i < STRIPES; i++)
+    if (__atomic_load_n(&readers[group][i].count, __ATOMIC_SEQ_CST) != 0)
+      return false;
+  return true;
+}
+
+/*
+ * Frees addr once no reader can be using the current snapshot, which refers
+ * to it. The next publish, which must replace that snapshot, retires it.
+ */
+extern "C" void _dl_phdr_retire(void *addr, size_t size, int mapped) {
+  retired *r = (retired *)_dl_alloc(sizeof(retired));
+  r->addr = addr;
+  r->size = size;
+  r->mapped = mapped;
+  r->next = pending;
+  pending = r;
+}
+
+// frees whatever is waiting on a group no reader is in
+static void reclaim() {
+  bool empty[2] = {drained(0), drained(1)};
+  for (retired **p = &waiting, *r; (r = *p) != 0;) {
+    if (!empty[r->group]) {
+      p = &r->next;
+      continue;
+    }
+    *p = r->next;
+    if (r->mapped)
+      munmap((uintptr_t)r->addr, r->size);
+    else
+      _dl_free(r->addr, r->size);
+    _dl_free(r, sizeof(retired));
+  }
+}
+
+/*
+ * Publishes a snapshot of the link_map chain, and retires the one it replaces.
+ * Called with the loader lock held, or at startup.
+ */
+extern "C" void _dl_phdr_publish() {
+  size_t count = 0;
+  for (struct link_map *lm = _dl_head; lm != 0; lm = lm->l_next)
+    count++;
+
+  size_t size = sizeof(dl_phdr_snapshot) + count * sizeof(dl_phdr_info);
+  dl_phdr_snapshot *snap = (dl_phdr_snapshot *)_dl_alloc(size);
+  snap->size = size;
+  snap->count = count;
+
+  dl_phdr_info *info = snap->info;
+  for (struct link_map *lm = _dl_head; lm != 0; lm = lm->l_next, info++) {
+    dl_object *obj = (dl_object *)lm;
+    obj->flags |= DL_OBJ_PUBLISHED;
+    info->dlpi_addr = obj->map.l_base;
+    info->dlpi_name = obj->map.l_name;
+    info->dlpi_phdr = obj->phdr;
+    info->dlpi_phnum = obj->phnum;
+    info->dlpi_adds = _dl_adds;
+    info->dlpi_subs = _dl_subs;
+    info->dlpi_tls_modid = obj->tls_modid;
+  }
+
+  dl_phdr_snapshot *old = __atomic_exchange_n(&current, snap, __ATOMIC_SEQ_CST);
+  if (old == 0)
+    return;
+  _dl_phdr_retire(old, old->size, false);
+  unsigned long group = __atomic_fetch_add(&epoch, 1, __ATOMIC_SEQ_CST) & 1;
+  while (pending != 0) {
+    retired *r = pending;
+    pending = r->next;
+    r->group = group;
+    r->next = waiting;
+    waiting = r;
+  }
+  reclaim();
+}
+
+extern "C" __protected int dl_iterate_phdr(
+    int (*callback)(struct dl_phdr_info *, size_t, void *), void *data) {
+  unsigned int s = stripe();
+  unsigned long group;
+  for (;;) {
+    group = __atomic_load_n(&epoch, __ATOMIC_SEQ_CST) & 1;
+    __atomic_fetch_add(&readers[group][s].count, 1, __ATOMIC_SEQ_CST);
+    if ((__atomic_load_n(&epoch, __ATOMIC_SEQ_CST) & 1) == group)
+      break;
+    __atomic_fetch_sub(&readers[group][s].count, 1, __ATOMIC_SEQ_CST);
+  }
+
+  int ret = 0;
+  dl_phdr_snapshot *snap = __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+  for (size_t i = 0; snap != 0 && i < snap->count && ret == 0; i++) {
+    // a copy, so a callback can't change what other threads see
+    dl_phdr_info info = snap->info[i];
+    if (info.dlpi_tls_modid != 0)
+      info.dlpi_tls_data = _dl_tls_current(info.dlpi_tls_modid);
+    ret = callback(&info, sizeof(info), data);
+  }
+
+  __atomic_fetch_sub(&readers[group][s].count, 1, __ATOMIC_SEQ_CST);
+  return ret;
+}
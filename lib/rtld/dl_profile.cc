@@ -0,0 +1,256 @@
+#include "private.h"
+
+/*
+ * LD_PROFILE=name[,name...] counts the calls the named objects (by soname, or
+ * file name for those without one) make through their PLT, and the TSC ticks
+ * spent in each callee, children included.
+ *
+ * A profiled object's JUMP_SLOT entries are left pointing at their lazy
+ * binding stubs, which push the relocation index and jump to PLT0, which
+ * pushes GOT[1] and jumps to GOT[2]. Those are set to the object and
+ * _dl_profile_plt, see x86_64/_profile.S, which counts the call and swaps its
+ * return address for _dl_profile_return, keeping the real one on a stack of
+ * its thread's. Each object's real targets are kept in a table here.
+ *
+ * Counters live in a shared mapping of $LD_PROFILE_OUTPUT/name.profile
+ * (/var/tmp by default), so they are in the file however the program exits,
+ * with nothing to write out. The file is a profile_header, then a
+ * profile_record per JUMP_SLOT, then the symbol names the records point at.
+ *
+ * As return addresses are swapped, C++ exceptions can't unwind through a
+ * profiled call. A longjmp() past one loses its time, but not its count.
+ * Objects with deferred dependencies need PLT0 for those, see dl_lazy.cc, so
+ * they aren't profiled.
+ */
+
+#define PROFILE_MAGIC "rtldprf1"
+#define STACK_SIZE 0x10000
+
+struct profile_header {
+  char magic[8];
+  uint32_t count;
+  // bytes of names after the records
+  uint32_t names;
+};
+
+struct profile_record {
+  uint64_t calls, ticks;
+  // offset of the symbol's name from the end of the records
+  uint32_t name;
+  uint32_t reserved;
+};
+
+struct dl_profile {
+  profile_record *records;
+  unsigned long *targets;
+  void *mapping;
+  size_t mapping_size;
+};
+
+struct profile_call {
+  unsigned long ret;
+  unsigned long *slot;
+  profile_record *record;
+  unsigned long long start;
+};
+
+// a thread's calls in progress, innermost last
+struct dl_profile_stack {
+  size_t depth;
+  profile_call calls[(STACK_SIZE - 16) / sizeof(profile_call)];
+};
+
+static const char *names, *output;
+
+// the entry of LD_PROFILE naming an object, with its length, if there is one
+static const char *selected(const char *name, size_t *len) {
+  const char *base = name;
+  for (const char *p = name; *p != 0; p++)
+    if (*p == '/')
+      base = p + 1;
+  *len = strlen(base);
+  return _dl_list_find(names, base, *len);
+}
+
+static const char *object_name(const dl_object *obj) {
+  if (obj->soname != 0)
+    return obj->soname;
+  if (obj->map.l_name[0] != 0)
+    return obj->map.l_name;
+  const char *execfn = (const char *)_getauxval(AT_EXECFN);
+  return execfn != 0 ? execfn : "";
+}
+
+// creates the output file, sized for its records and names, and maps it
+static void *create(
+    const char *name, size_t len, size_t size, size_t *mapping_size) {
+  char path[DL_PATH_MAX];
+  size_t dir_len = strlen(output);
+  if (dir_len + len + 10 > sizeof(path))
+    return 0;
+  memcpy(path, output, dir_len);
+  path[dir_len] = '/';
+  memcpy(path + dir_len + 1, name, len);
+  memcpy(path + dir_len + 1 + len, ".profile", 9);
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return 0;
+  uintptr_t addr = -1UL;
+  if (ftruncate(fd, size) == 0)
+    addr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr > -4096UL)
+    return 0;
+
+  *mapping_size = size;
+  return (void *)addr;
+}
+
+extern "C" void _dl_profile_init() {
+  names = _dl_getenv("LD_PROFILE");
+  if (names == 0 || names[0] == 0 || _getauxval(AT_SECURE)) {
+    names = 0;
+    return;
+  }
+
+  output = _dl_getenv("LD_PROFILE_OUTPUT");
+  if (output == 0 || output[0] == 0)
+    output = "/var/tmp";
+}
+
+/*
+ * Sets an object up to be profiled, if LD_PROFILE names it. Called before it
+ * is relocated.
+ */
+extern "C" void _dl_profile_setup(dl_object *obj) {
+  size_t len;
+  const char *name;
+  if (names == 0 || obj->pltgot == 0 || obj->jmprelcount == 0 ||
+      obj->deferred != 0 || (name = selected(object_name(obj), &len)) == 0)
+    return;
+
+  size_t count = obj->jmprelcount, strings = 0;
+  for (size_t i = 0; i < count; i++) {
+    const Elf64_Sym *sym = &obj->symtab[ELF64_R_SYM(obj->jmprel[i].r_info)];
+    strings += strlen(obj->strtab + sym->st_name) + 1;
+  }
+
+  size_t size =
+      sizeof(profile_header) + count * sizeof(profile_record) + strings;
+  dl_profile *p = (dl_profile *)_dl_alloc(sizeof(dl_profile));
+  p->mapping = create(name, len, size, &p->mapping_size);
+  if (p->mapping == 0) {
+    _dl_free(p, sizeof(dl_profile));
+    return;
+  }
+
+  profile_header *header = (profile_header *)p->mapping;
+  memcpy(header->magic, PROFILE_MAGIC, 8);
+  header->count = count;
+  header->names = strings;
+  p->records = (profile_record *)(header + 1);
+  p->targets = (unsigned long *)_dl_alloc(count * sizeof(unsigned long));
+
+  char *out = (char *)(p->records + count);
+  size_t off = 0;
+  for (size_t i = 0; i < count; i++) {
+    const Elf64_Sym *sym = &obj->symtab[ELF64_R_SYM(obj->jmprel[i].r_info)];
+    const char *s = obj->strtab + sym->st_name;
+    size_t n = strlen(s) + 1;
+    memcpy(out + off, s, n);
+    p->records[i].name = off;
+    off += n;
+  }
+
+  obj->profile = p;
+  obj->pltgot[1] = (unsigned long)obj;
+  obj->pltgot[2] = (unsigned long)_dl_profile_plt;
+}
+
+/*
+ * Binds a JUMP_SLOT of a profiled object to target through its lazy stub.
+ * Returns false if it has none, and must be bound directly.
+ */
+extern "C" int _dl_profile_bind(
+    dl_object *obj, const Elf64_Rela *rela, unsigned long target) {
+  unsigned long *where = (unsigned long *)(obj->map.l_base + rela->r_offset);
+  if (target == 0 || *where == 0)
+    return 0;
+
+  obj->profile->targets[rela - obj->jmprel] = target;
+  *where += obj->map.l_base;
+  return 1;
+}
+
+extern "C" void _dl_profile_unload(dl_object *obj) {
+  dl_profile *p = obj->profile;
+  if (p == 0)
+    return;
+
+  munmap(p->mapping, p->mapping_size);
+  _dl_free(p->targets, obj->jmprelcount * sizeof(unsigned long));
+  _dl_free(p, sizeof(dl_profile));
+  obj->profile = 0;
+}
+
+// frees a thread's stack of calls, as its TCB is freed
+extern "C" void _dl_profile_free(dl_tcb *tcb) {
+  if (tcb->profile != 0)
+    munmap(tcb->profile, STACK_SIZE);
+  tcb->profile = 0;
+}
+
+/*
+ * Counts a call through a profiled object's PLT, and times it unless its
+ * thread has too many in progress. slot holds the caller's return address.
+ * Returns where the call goes.
+ */
+extern "C" unsigned long _dl_profile_enter(
+    const dl_object *obj, unsigned long index, unsigned long *slot) {
+  dl_profile *p = obj->profile;
+  profile_record *record = &p->records[index];
+  __atomic_fetch_add(&record->calls, 1, __ATOMIC_RELAXED);
+
+  dl_tcb *tcb = dl_tcb_self();
+  if (tcb->profile == 0) {
+    uintptr_t addr = mmap(
+        0, STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+        -1, 0);
+    if (addr > -4096UL)
+      return p->targets[index];
+    tcb->profile = (dl_profile_stack *)addr;
+  }
+
+  dl_profile_stack *stack = tcb->profile;
+  size_t max = sizeof(stack->calls) / sizeof(stack->calls[0]);
+  if (stack->depth < max) {
+    profile_call *call = &stack->calls[stack->depth++];
+    call->ret = *slot;
+    call->slot = slot;
+    call->record = record;
+    call->start = dl_rdtsc();
+    *slot = (unsigned long)_dl_profile_return;
+  }
+
+  return p->targets[index];
+}
+
+/*
+ * Ends the timed call whose return address was at slot, and returns that
+ * address. Calls a longjmp() abandoned were deeper in the stack, so they are
+ * dropped on the way.
+ */
+extern "C" unsigned long _dl_profile_exit(unsigned long *slot) {
+  unsigned long long now = dl_rdtsc();
+  dl_profile_stack *stack = dl_tcb_self()->profile;
+  while (stack->depth != 0 && stack->calls[stack->depth - 1].slot < slot)
+    stack->depth--;
+  if (stack->depth == 0 || stack->calls[stack->depth - 1].slot != slot)
+    _dl_fatal("lost the return address of a profiled call", 0);
+
+  profile_call *call = &stack->calls[--stack->depth];
+  unsigned long long ticks = now - call->start;
+  __atomic_fetch_add(&call->record->ticks, ticks, __ATOMIC_RELAXED);
+  return call->ret;
+}
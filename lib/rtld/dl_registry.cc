@@ -0,0 +1,191 @@
+#include "private.h"
+
+/*
+ * Index of loaded objects, so asking whether a library is already loaded
+ * doesn't mean walking every object. The link_map chain is still the record
+ * of what is loaded, and what debuggers read through _r_debug.
+ *
+ * Objects are found by name and by file identity. The names are an object's
+ * own: its DT_SONAME, its path and the last component of its path, which is
+ * what a DT_NEEDED entry nearly always uses. Keys only ever point into the
+ * object they index, so they live exactly as long as it does. A name that
+ * matches none of these still resolves to one copy, since the file is then
+ * opened and found by its (st_dev, st_ino).
+ *
+ * Both tables use open addressing and double when half full.
+ */
+
+#define TABLE_MIN 64
+
+// marks a slot whose entry was removed, which lookups must probe past
+#define DELETED ((dl_object *)-1)
+
+struct name_entry {
+  uint32_t hash;
+  const char *name;
+  dl_object *obj;
+};
+
+struct file_entry {
+  unsigned long dev, ino;
+  dl_object *obj;
+};
+
+static name_entry *names;
+static file_entry *files;
+// used counts deleted slots too, as they lengthen probes just the same
+static size_t names_mask, names_used, files_mask, files_used;
+
+__protected struct r_debug _r_debug;
+
+/*
+ * Debuggers set a breakpoint here, and read _r_debug when it's hit to see the
+ * link_map chain change.
+ */
+extern "C" __protected __noinline void _dl_debug_state() {
+  __compiler_membar();
+}
+
+static uint32_t file_hash(unsigned long dev, unsigned long ino) {
+  uint64_t h = (dev * 0x9e3779b97f4a7c15UL) ^ ino;
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+static void insert_name(
+    name_entry *table, size_t mask, uint32_t hash, const char *name,
+    dl_object *obj) {
+  size_t i = hash & mask;
+  while (table[i].obj != 0 && table[i].obj != DELETED)
+    i = (i + 1) & mask;
+  table[i].hash = hash;
+  table[i].name = name;
+  table[i].obj = obj;
+}
+
+static void insert_file(
+    file_entry *table, size_t mask, unsigned long dev, unsigned long ino,
+    dl_object *obj) {
+  size_t i = file_hash(dev, ino) & mask;
+  while (table[i].obj != 0 && table[i].obj != DELETED)
+    i = (i + 1) & mask;
+  table[i].dev = dev;
+  table[i].ino = ino;
+  table[i].obj = obj;
+}
+
+// grows (or first allocates) the name table, dropping deleted slots
+static void grow_names() {
+  size_t size = names != 0 ? (names_mask + 1) * 2 : TABLE_MIN;
+  name_entry *table = (name_entry *)_dl_alloc(size * sizeof(name_entry));
+
+  names_used = 0;
+  if (names != 0) {
+    for (size_t i = 0; i <= names_mask; i++) {
+      if (names[i].obj == 0 || names[i].obj == DELETED)
+        continue;
+      insert_name(table, size - 1, names[i].hash, names[i].name, names[i].obj);
+      names_used++;
+    }
+    _dl_free(names, (names_mask + 1) * sizeof(name_entry));
+  }
+
+  names = table;
+  names_mask = size - 1;
+}
+
+static void grow_files() {
+  size_t size = files != 0 ? (files_mask + 1) * 2 : TABLE_MIN;
+  file_entry *table = (file_entry *)_dl_alloc(size * sizeof(file_entry));
+
+  files_used = 0;
+  if (files != 0) {
+    for (size_t i = 0; i <= files_mask; i++) {
+      if (files[i].obj == 0 || files[i].obj == DELETED)
+        continue;
+      insert_file(table, size - 1, files[i].dev, files[i].ino, files[i].obj);
+      files_used++;
+    }
+    _dl_free(files, (files_mask + 1) * sizeof(file_entry));
+  }
+
+  files = table;
+  files_mask = size - 1;
+}
+
+static void add_name(const char *name, dl_object *obj) {
+  if (name == 0 || *name == 0 || _dl_find_name(name) != 0)
+    return;
+
+  if (names == 0 || (names_used + 1) * 2 > names_mask + 1)
+    grow_names();
+  insert_name(names, names_mask, dl_gnu_hash(name), name, obj);
+  names_used++;
+}
+
+extern "C" dl_object *_dl_find_name(const char *name) {
+  if (names == 0)
+    return 0;
+
+  uint32_t hash = dl_gnu_hash(name);
+  for (size_t i = hash & names_mask; names[i].obj != 0;
+       i = (i + 1) & names_mask) {
+    name_entry *e = &names[i];
+    if (e->obj != DELETED && e->hash == hash && strcmp(e->name, name) == 0)
+      return e->obj;
+  }
+  return 0;
+}
+
+extern "C" dl_object *_dl_find_file(unsigned long dev, unsigned long ino) {
+  if (files == 0)
+    return 0;
+
+  for (size_t i = file_hash(dev, ino) & files_mask; files[i].obj != 0;
+       i = (i + 1) & files_mask) {
+    file_entry *e = &files[i];
+    if (e->obj != DELETED && e->dev == dev && e->ino == ino)
+      return e->obj;
+  }
+  return 0;
+}
+
+/*
+ * Indexes an object by its path and file identity. Its soname is added once
+ * its dynamic section has been parsed.
+ */
+extern "C" void _dl_register(dl_object *obj) {
+  const char *path = obj->map.l_name;
+  const char *base = path;
+  for (const char *p = path; *p; p++)
+    if (*p == '/')
+      base = p + 1;
+
+  add_name(path, obj);
+  add_name(base, obj);
+
+  if (obj->ino != 0 && _dl_find_file(obj->dev, obj->ino) == 0) {
+    if (files == 0 || (files_used + 1) * 2 > files_mask + 1)
+      grow_files();
+    insert_file(files, files_mask, obj->dev, obj->ino, obj);
+    files_used++;
+  }
+}
+
+extern "C" void _dl_register_soname(dl_object *obj) {
+  add_name(obj->soname, obj);
+}
+
+// indexes an object by another name, which must live as long as it does
+extern "C" void _dl_register_name(dl_object *obj, const char *name) {
+  add_name(name, obj);
+}
+
+// removes every entry for an object that is being unloaded
+extern "C" void _dl_unregister(dl_object *obj) {
+  for (size_t i = 0; names != 0 && i <= names_mask; i++)
+    if (names[i].obj == obj)
+      names[i].obj = DELETED;
+  for (size_t i = 0; files != 0 && i <= files_mask; i++)
+    if (files[i].obj == obj)
+      files[i].obj = DELETED;
+}
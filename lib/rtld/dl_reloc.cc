@@ -0,0 +1,366 @@
+#include "private.h"
+
+/*
+ * Relocation runs in two passes.
+ *
+ * The first handles the types that only read symbol tables and write their
+ * own target (RELATIVE, 64, GLOB_DAT, JUMP_SLOT), which is nearly all of them.
+ * No entry depends on another, so the pass is cut into chunks that any thread
+ * may take, whether they are whole small objects or ranges of a large one.
+ * At startup, with LD_RELOC_THREADS=n and enough relocations to be worth it,
+ * up to n short-lived helper threads take chunks alongside the main thread.
+ * Later, for dlopen() or a deferred dependency, the calling thread relocates
+ * alone: it may be any of the program's threads, with signals it handles
+ * unblocked, and helpers would share its TCB and handlers.
+ *
+ * The second pass runs on the calling thread alone, once every object has
+ * been through the first, dependencies before their dependents. It handles
+ * what can't be split: COPY relocations, which need the source object's data
+ * relocated, IRELATIVE relocations and references to IFUNC symbols, whose
+ * resolvers are arbitrary code that may use relocated data, and TLSDESC
+ * relocations, which may allocate from the arena.
+ */
+
+// fewest relocations, across all objects, worth starting helper threads for
+#define PARALLEL_MIN 0x10000
+// relocations a thread takes at a time
+#define CHUNK_SIZE 0x1000
+#define MAX_HELPERS 15
+#define HELPER_STACK_SIZE 0x10000
+
+enum { PASS_PARALLEL, PASS_SERIAL };
+
+struct helper {
+  // set by the kernel at clone, and cleared with a futex wake on exit
+  volatile int tid;
+  uintptr_t stack;
+};
+
+// the next chunk to take, and how many there are, shared by all threads
+static unsigned long next_chunk, total_chunks;
+
+/*
+ * Finds the definition a symbolic relocation refers to. Returns false for an
+ * undefined weak symbol or a call left to dl_lazy.cc, and aborts for any
+ * other undefined symbol.
+ */
+static bool symbol(
+    dl_object *obj, const Elf64_Rela *rela, const Elf64_Sym **sym,
+    dl_object **def) {
+  const Elf64_Sym *ref = &obj->symtab[ELF64_R_SYM(rela->r_info)];
+
+  // local symbols, like section symbols, can only mean this object
+  if (ELF64_ST_BIND(ref->st_info) == STB_LOCAL) {
+    *sym = ref;
+    *def = obj;
+    return true;
+  }
+
+  uint32_t index = ELF64_R_SYM(rela->r_info);
+  if (obj->bind != 0) {
+    int found = _dl_bind_replay(obj, index, sym, def);
+    if (found != 0) {
+      dl_stats_count(&_dl_stats.bind_hits, 1);
+      return found > 0;
+    }
+  }
+
+  const char *name = obj->strtab + ref->st_name;
+  *sym = _dl_lookup_direct(name, obj, index, def);
+  if (*sym == 0)
+    *sym = _dl_lookup(name, 0, def);
+  // objects dlopen()ed without RTLD_GLOBAL also see their own dependencies
+  if (*sym == 0 && !(obj->flags & DL_OBJ_GLOBAL))
+    *sym = _dl_lookup_tree(name, obj, def);
+  if (obj->bind != 0)
+    _dl_bind_record(obj, index, *sym, *def);
+  if (*sym != 0)
+    return true;
+  // calls into deferred dependencies are bound when first made
+  if (obj->deferred != 0 &&
+      ELF64_R_TYPE(rela->r_info) == R_TARGET_JUMP_SLOT)
+    return false;
+  if (ELF64_ST_BIND(ref->st_info) == STB_WEAK)
+    return false;
+  _dl_fatal("undefined symbol", name);
+}
+
+// TLS relocations refer to a module, and an offset within its block
+static void relocate_tls(
+    dl_object *obj, const Elf64_Rela *rela, const Elf64_Sym *sym,
+    const dl_object *def, unsigned long *where) {
+  unsigned long offset = sym->st_value + rela->r_addend;
+
+  switch (ELF64_R_TYPE(rela->r_info)) {
+  case R_TARGET_DTPMOD64:
+    *where = def->tls_modid;
+    break;
+  case R_TARGET_DTPOFF64:
+    *where = offset;
+    break;
+  case R_TARGET_TPOFF64:
+    // initial-exec code can only reach the static area
+    if (!(def->flags & DL_OBJ_STATIC_TLS))
+      _dl_fatal("cannot use initial-exec TLS from", def->map.l_name);
+    *where = offset - def->tls_offset;
+    break;
+  case R_TARGET_TLSDESC:
+    _dl_tls_desc(obj, def, offset, where);
+    break;
+  }
+}
+
+static void relocate(
+    dl_object *obj, const Elf64_Rela *rela, size_t count, int pass) {
+  unsigned long base = obj->map.l_base;
+
+  for (; count != 0; rela++, count--) {
+    unsigned long *where = (unsigned long *)(base + rela->r_offset);
+    const Elf64_Sym *sym;
+    dl_object *def;
+
+    switch (ELF64_R_TYPE(rela->r_info)) {
+    case R_TARGET_NONE:
+      break;
+
+    case R_TARGET_RELATIVE:
+      if (pass == PASS_PARALLEL)
+        *where = base + rela->r_addend;
+      break;
+
+    case R_TARGET_64:
+    case R_TARGET_GLOB_DAT:
+    case R_TARGET_JUMP_SLOT: {
+      // only objects that deferred an IFUNC reference need a second look
+      if (pass == PASS_SERIAL && !(obj->flags & DL_OBJ_IFUNC_REFS))
+        break;
+
+      unsigned long value = 0;
+      if (symbol(obj, rela, &sym, &def)) {
+        bool ifunc = ELF64_ST_TYPE(sym->st_info) == STT_GNU_IFUNC;
+        if (ifunc != (pass == PASS_SERIAL)) {
+          if (ifunc)
+            __atomic_fetch_or(
+                &obj->flags, DL_OBJ_IFUNC_REFS, __ATOMIC_RELAXED);
+          break;
+        }
+
+        value = def->map.l_base + sym->st_value;
+        if (ifunc)
+          value = ((unsigned long (*)(void))value)();
+      } else if (pass == PASS_SERIAL) {
+        break;
+      } else if (obj->deferred != 0 &&
+                 ELF64_R_TYPE(rela->r_info) == R_TARGET_JUMP_SLOT) {
+        // its lazy binding stub, until the call is first made
+        *where += base;
+        break;
+      }
+
+      if (ELF64_R_TYPE(rela->r_info) == R_TARGET_64)
+        value += rela->r_addend;
+      else if (ELF64_R_TYPE(rela->r_info) == R_TARGET_JUMP_SLOT &&
+               obj->profile != 0 && _dl_profile_bind(obj, rela, value))
+        break;
+      *where = value;
+      break;
+    }
+
+    case R_TARGET_COPY: {
+      if (pass == PASS_PARALLEL)
+        break;
+
+      const Elf64_Sym *ref = &obj->symtab[ELF64_R_SYM(rela->r_info)];
+      const char *name = obj->strtab + ref->st_name;
+      sym = _dl_lookup(name, obj, &def);
+      if (sym == 0)
+        _dl_fatal("undefined symbol", name);
+      memcpy(where, (void *)(def->map.l_base + sym->st_value), ref->st_size);
+      break;
+    }
+
+    case R_TARGET_DTPMOD64:
+    case R_TARGET_DTPOFF64:
+    case R_TARGET_TPOFF64:
+      if (pass == PASS_PARALLEL && symbol(obj, rela, &sym, &def))
+        relocate_tls(obj, rela, sym, def, where);
+      break;
+
+    // for dynamic TLS, this allocates, and the arena isn't thread safe
+    case R_TARGET_TLSDESC:
+      if (pass == PASS_SERIAL && symbol(obj, rela, &sym, &def))
+        relocate_tls(obj, rela, sym, def, where);
+      break;
+
+    case R_TARGET_IRELATIVE:
+      if (pass == PASS_SERIAL)
+        *where = ((unsigned long (*)(void))(base + rela->r_addend))();
+      break;
+
+    default:
+      _dl_fatal("unsupported relocation type", obj->map.l_name);
+    }
+  }
+}
+
+// DT_RELR packs RELATIVE relocations as addresses followed by bitmaps
+static void relocate_relr(dl_object *obj) {
+  unsigned long base = obj->map.l_base;
+  unsigned long *where = 0;
+
+  for (size_t i = 0; i < obj->relrcount; i++) {
+    Elf64_Relr entry = obj->relr[i];
+    if ((entry & 1) == 0) {
+      where = (unsigned long *)(base + entry);
+      *where++ += base;
+    } else {
+      for (unsigned long *p = where; (entry >>= 1) != 0; p++)
+        if (entry & 1)
+          *p += base;
+      where += 8 * sizeof(Elf64_Relr) - 1;
+    }
+  }
+}
+
+static unsigned long chunks(size_t count) {
+  return (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+
+// runs the first pass over one chunk, which are numbered across all objects
+static void run_chunk(unsigned long chunk) {
+  for (struct link_map *lm = _dl_head; lm != 0; lm = lm->l_next) {
+    dl_object *obj = (dl_object *)lm;
+    if (obj->flags & DL_OBJ_RELOCATED)
+      continue;
+
+    const Elf64_Rela *tables[2] = {obj->rela, obj->jmprel};
+    size_t counts[2] = {obj->relacount, obj->jmprelcount};
+    for (int t = 0; t < 2; t++) {
+      unsigned long n = chunks(counts[t]);
+      if (chunk < n) {
+        size_t start = chunk * CHUNK_SIZE;
+        size_t count = counts[t] - start;
+        if (count > CHUNK_SIZE)
+          count = CHUNK_SIZE;
+        unsigned long long time = dl_stats_begin();
+        relocate(obj, tables[t] + start, count, PASS_PARALLEL);
+        dl_stats_end(&obj->reloc_time, time);
+        return;
+      }
+      chunk -= n;
+    }
+  }
+}
+
+static void worker(void *) {
+  for (;;) {
+    unsigned long chunk =
+        __atomic_fetch_add(&next_chunk, 1, __ATOMIC_RELAXED);
+    if (chunk >= total_chunks)
+      return;
+    run_chunk(chunk);
+  }
+}
+
+// helper threads to start, limited by LD_RELOC_THREADS and available CPUs
+static unsigned long helper_count(size_t relocs) {
+  const char *env = _dl_getenv("LD_RELOC_THREADS");
+  if (env == 0 || relocs < PARALLEL_MIN)
+    return 0;
+
+  unsigned long n = _dl_atoul(env);
+  if (n > MAX_HELPERS)
+    n = MAX_HELPERS;
+  if (n > total_chunks - 1)
+    n = total_chunks - 1;
+
+  unsigned long mask[16];
+  long len = sched_getaffinity(0, sizeof(mask), mask);
+  if (len > 0) {
+    unsigned long cpus = 0;
+    for (long i = 0; i < len / (long)sizeof(unsigned long); i++)
+      for (unsigned long m = mask[i]; m != 0; m &= m - 1)
+        cpus++;
+    if (n > cpus - 1)
+      n = cpus - 1;
+  }
+
+  return n;
+}
+
+static bool spawn(helper *h) {
+  h->stack = mmap(
+      0, HELPER_STACK_SIZE, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (h->stack > -4096UL)
+    return false;
+
+  struct clone_args args;
+  memset(&args, 0, sizeof(args));
+  args.flags = CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND |
+               CLONE_THREAD | CLONE_SYSVSEM | CLONE_PARENT_SETTID |
+               CLONE_CHILD_CLEARTID;
+  args.parent_tid = (uintptr_t)&h->tid;
+  args.child_tid = (uintptr_t)&h->tid;
+  args.stack = h->stack;
+  args.stack_size = HELPER_STACK_SIZE;
+
+  if (_dl_clone(&args, sizeof(args), worker, 0) < 0) {
+    munmap(h->stack, HELPER_STACK_SIZE);
+    return false;
+  }
+  return true;
+}
+
+static void join(helper *h) {
+  for (int tid; (tid = h->tid) != 0;)
+    futex(&h->tid, FUTEX_WAIT, tid, 0);
+  munmap(h->stack, HELPER_STACK_SIZE);
+}
+
+/*
+ * Relocates every object that hasn't been yet, then makes their RELRO
+ * segments read-only. Only startup, before the program runs, may pass
+ * parallel.
+ */
+extern "C" void _dl_relocate_all(int parallel) {
+  size_t relocs = 0;
+  total_chunks = next_chunk = 0;
+  for (struct link_map *lm = _dl_head; lm != 0; lm = lm->l_next) {
+    dl_object *obj = (dl_object *)lm;
+    if (obj->flags & DL_OBJ_RELOCATED)
+      continue;
+
+    unsigned long long time = dl_stats_begin();
+    relocate_relr(obj);
+    dl_stats_end(&obj->reloc_time, time);
+    _dl_profile_setup(obj);
+    relocs += obj->relacount + obj->jmprelcount;
+    total_chunks += chunks(obj->relacount) + chunks(obj->jmprelcount);
+  }
+
+  // failing to start a helper only means less help
+  helper helpers[MAX_HELPERS];
+  unsigned long nhelpers = parallel ? helper_count(relocs) : 0, started = 0;
+  while (started < nhelpers && spawn(&helpers[started]))
+    started++;
+
+  worker(0);
+  for (unsigned long i = 0; i < started; i++)
+    join(&helpers[i]);
+
+  for (struct link_map *lm = _dl_tail; lm != 0; lm = lm->l_prev) {
+    dl_object *obj = (dl_object *)lm;
+    if (obj->flags & DL_OBJ_RELOCATED)
+      continue;
+
+    unsigned long long time = dl_stats_begin();
+    relocate(obj, obj->rela, obj->relacount, PASS_SERIAL);
+    relocate(obj, obj->jmprel, obj->jmprelcount, PASS_SERIAL);
+    dl_stats_end(&obj->reloc_time, time);
+    obj->flags |= DL_OBJ_RELOCATED;
+
+    if (obj->relro_end > obj->relro_start)
+      mprotect(obj->relro_start, obj->relro_end - obj->relro_start, PROT_READ);
+  }
+}
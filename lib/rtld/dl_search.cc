@@ -0,0 +1,324 @@
+#include "private.h"
+
+/*
+ * Library search directories are read once with getdents64, and the names in
+ * them are kept as a set of hashes. A library is only opened in a directory
+ * whose set holds its hash, so resolving a DT_NEEDED entry never costs an
+ * open() that fails with ENOENT in every directory before the right one.
+ *
+ * Only hashes are stored, as a collision just costs one extra open. They are
+ * kept in an open addressed table that doubles whenever it is half full.
+ *
+ * A directory with a hwcaps subdirectory is searched for the variants of a
+ * library built for the CPU first, see dl_hwcaps.cc. Those directories are
+ * made the first time they are needed and read like any other.
+ */
+
+#define DIR_TABLE_MIN 256
+
+enum {
+  DIR_UNREAD,
+  DIR_CACHED,
+  // the directory doesn't exist, nothing can be found in it
+  DIR_MISSING,
+  // the directory can't be listed (e.g. search-only permission), open blindly
+  DIR_UNCACHED,
+};
+
+struct dl_dir {
+  dl_dir *next;
+  // not NUL terminated, it points into the string the directory came from
+  const char *path;
+  size_t len;
+  int state;
+  // name hashes, with 0 marking an empty slot
+  uint32_t *table;
+  uint32_t mask, count;
+  // <path>/hwcaps/<level> for each of _dl_hwcaps, or 0 until first needed
+  dl_dir **variants;
+
+  void *operator new(unsigned long);
+};
+
+struct dl_search_path {
+  dl_search_path *next;
+  dl_dir *dir;
+
+  void *operator new(unsigned long);
+};
+
+void *dl_dir::operator new(unsigned long size) {
+  return _dl_alloc(size);
+}
+void *dl_search_path::operator new(unsigned long size) {
+  return _dl_alloc(size);
+}
+
+// every directory seen so far, so each is only ever read once
+static dl_dir *dirs;
+
+static dl_search_path *env_path, *conf_path, *default_path;
+static uint32_t hwcaps_hash;
+
+struct dl_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+static dl_dir *get_dir(const char *path, size_t len) {
+  // trailing slashes would make the same directory look different
+  while (len > 1 && path[len - 1] == '/')
+    len--;
+
+  for (dl_dir *dir = dirs; dir != 0; dir = dir->next)
+    if (dir->len == len && strncmp(dir->path, path, len) == 0)
+      return dir;
+
+  dl_dir *dir = new dl_dir;
+  dir->path = path;
+  dir->len = len;
+  dir->state = DIR_UNREAD;
+  dir->next = dirs;
+  dirs = dir;
+  return dir;
+}
+
+// a real hash of 0 is stored as 1, which at worst costs an extra open
+static uint32_t slot_hash(uint32_t hash) {
+  return hash != 0 ? hash : 1;
+}
+
+static void insert(uint32_t *table, uint32_t mask, uint32_t hash) {
+  uint32_t i = hash & mask;
+  while (table[i] != 0 && table[i] != hash)
+    i = (i + 1) & mask;
+  table[i] = hash;
+}
+
+static void add_hash(dl_dir *dir, uint32_t hash) {
+  hash = slot_hash(hash);
+
+  if (dir->table == 0 || (dir->count + 1) * 2 > dir->mask + 1) {
+    uint32_t size = dir->table != 0 ? (dir->mask + 1) * 2 : DIR_TABLE_MIN;
+    uint32_t *table = (uint32_t *)_dl_alloc(size * sizeof(uint32_t));
+    if (dir->table != 0) {
+      for (uint32_t i = 0; i <= dir->mask; i++)
+        if (dir->table[i] != 0)
+          insert(table, size - 1, dir->table[i]);
+      _dl_free(dir->table, (dir->mask + 1) * sizeof(uint32_t));
+    }
+    dir->table = table;
+    dir->mask = size - 1;
+  }
+
+  insert(dir->table, dir->mask, hash);
+  dir->count++;
+}
+
+static void read_dir(dl_dir *dir) {
+  char path[DL_PATH_MAX];
+  if (dir->len >= sizeof(path)) {
+    dir->state = DIR_MISSING;
+    return;
+  }
+  memcpy(path, dir->path, dir->len);
+  path[dir->len] = 0;
+
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+  if (fd < 0) {
+    dir->state = (fd == -EACCES) ? DIR_UNCACHED : DIR_MISSING;
+    return;
+  }
+
+  __aligned(8) char buf[0x2000];
+  for (;;) {
+    long n = getdents64(fd, buf, sizeof(buf));
+    if (n == 0)
+      break;
+    if (n < 0) {
+      // a partial listing can't prove anything is missing
+      dir->state = DIR_UNCACHED;
+      close(fd);
+      return;
+    }
+
+    for (long off = 0; off < n;) {
+      dl_dirent64 *ent = (dl_dirent64 *)(buf + off);
+      off += ent->d_reclen;
+
+      if (ent->d_name[0] == '.' &&
+          (ent->d_name[1] == 0 || (ent->d_name[1] == '.' && ent->d_name[2] == 0)))
+        continue;
+      add_hash(dir, dl_gnu_hash(ent->d_name));
+    }
+  }
+
+  close(fd);
+  dir->state = DIR_CACHED;
+}
+
+static bool may_contain(dl_dir *dir, uint32_t hash) {
+  if (dir->state == DIR_UNREAD)
+    read_dir(dir);
+
+  switch (dir->state) {
+  case DIR_MISSING:
+    return false;
+  case DIR_UNCACHED:
+    return true;
+  }
+
+  if (dir->table == 0)
+    return false;
+
+  hash = slot_hash(hash);
+  for (uint32_t i = hash & dir->mask; dir->table[i] != 0;
+       i = (i + 1) & dir->mask)
+    if (dir->table[i] == hash)
+      return true;
+  return false;
+}
+
+// opens name, of length len, in dir if it may be there, leaving the path in buf
+static int open_in(
+    dl_dir *dir, const char *name, size_t len, uint32_t hash, char *buf) {
+  if (!may_contain(dir, hash)) {
+    dl_stats_count(&_dl_stats.dirs_skipped, 1);
+    return -ENOENT;
+  }
+  if (dir->len + len + 2 > DL_PATH_MAX)
+    return -ENAMETOOLONG;
+
+  memcpy(buf, dir->path, dir->len);
+  buf[dir->len] = '/';
+  memcpy(buf + dir->len + 1, name, len + 1);
+
+  int fd = open(buf, O_RDONLY | O_CLOEXEC, 0);
+  dl_stats_count(&_dl_stats.opens, 1);
+  if (fd < 0)
+    dl_stats_count(&_dl_stats.failed_opens, 1);
+  return fd;
+}
+
+static dl_dir **get_variants(dl_dir *dir) {
+  dl_dir **variants =
+      (dl_dir **)_dl_alloc(_dl_hwcaps_count * sizeof(dl_dir *));
+  for (int i = 0; i < _dl_hwcaps_count; i++) {
+    size_t len = strlen(_dl_hwcaps[i]);
+    char *path = (char *)_dl_alloc(dir->len + len + 9);
+    memcpy(path, dir->path, dir->len);
+    memcpy(path + dir->len, "/hwcaps/", 8);
+    memcpy(path + dir->len + 8, _dl_hwcaps[i], len + 1);
+    variants[i] = get_dir(path, dir->len + len + 8);
+  }
+  return variants;
+}
+
+/*
+ * Opens name in the first directory of path that holds it, or a variant of
+ * it, leaving the full path in buf. Returns the file descriptor, or -ENOENT
+ * if no directory does.
+ */
+static int search_path(
+    dl_search_path *path, const char *name, uint32_t hash, char *buf) {
+  size_t len = strlen(name);
+
+  for (; path != 0; path = path->next) {
+    dl_dir *dir = path->dir;
+    int fd;
+    // a directory without a hwcaps subdirectory costs no more than before
+    if (_dl_hwcaps_count != 0 && may_contain(dir, hwcaps_hash)) {
+      if (dir->variants == 0)
+        dir->variants = get_variants(dir);
+      for (int i = 0; i < _dl_hwcaps_count; i++)
+        if ((fd = open_in(dir->variants[i], name, len, hash, buf)) >= 0)
+          return fd;
+    }
+    if ((fd = open_in(dir, name, len, hash, buf)) >= 0)
+      return fd;
+  }
+
+  return -ENOENT;
+}
+
+extern "C" dl_search_path **
+_dl_search_path_add(dl_search_path **tail, const char *dir, size_t len) {
+  if (len == 0)
+    return tail;
+
+  dl_search_path *path = new dl_search_path;
+  path->next = 0;
+  path->dir = get_dir(dir, len);
+  *tail = path;
+  return &path->next;
+}
+
+// parses a colon separated directory list, like LD_LIBRARY_PATH or DT_RUNPATH
+extern "C" dl_search_path *_dl_search_path_parse(const char *list) {
+  dl_search_path *path = 0, **tail = &path;
+
+  const char *dir = list;
+  for (const char *p = list;; p++) {
+    if (*p == ':' || *p == ';' || *p == 0) {
+      tail = _dl_search_path_add(tail, dir, p - dir);
+      dir = p + 1;
+    }
+    if (*p == 0)
+      break;
+  }
+
+  return path;
+}
+
+extern "C" void _dl_search_init() {
+  // LD_LIBRARY_PATH isn't trusted for setuid/setgid programs
+  const char *env = _dl_getenv("LD_LIBRARY_PATH");
+  if (env != 0 && !_getauxval(AT_SECURE))
+    env_path = _dl_search_path_parse(env);
+
+  unsigned long long t = dl_stats_begin();
+  conf_path = parse_ld_conf();
+  dl_stats_end(&_dl_stats.phase[DL_PHASE_CONF], t);
+  default_path = _dl_search_path_parse("/lib:/usr/lib");
+
+  _dl_hwcaps_init();
+  hwcaps_hash = dl_gnu_hash("hwcaps");
+}
+
+/*
+ * Opens a DT_NEEDED library for an object with the given DT_RPATH and
+ * DT_RUNPATH directories, searched in the usual order: DT_RPATH (only when
+ * there is no DT_RUNPATH), LD_LIBRARY_PATH, DT_RUNPATH, ld.so.conf, then the
+ * default directories. The path opened is left in path, which must hold
+ * DL_PATH_MAX bytes.
+ */
+extern "C" int _dl_search_library(
+    const char *name, dl_search_path *rpath, dl_search_path *runpath,
+    char *path) {
+  // names with a slash are paths, and are not searched for
+  for (const char *p = name; *p; p++) {
+    if (*p == '/') {
+      size_t len = strlen(name);
+      if (len >= DL_PATH_MAX)
+        return -ENAMETOOLONG;
+      memcpy(path, name, len + 1);
+      return open(name, O_RDONLY | O_CLOEXEC, 0);
+    }
+  }
+
+  uint32_t hash = dl_gnu_hash(name);
+  int fd = -ENOENT;
+
+  if (runpath == 0 && (fd = search_path(rpath, name, hash, path)) >= 0)
+    return fd;
+  if ((fd = search_path(env_path, name, hash, path)) >= 0)
+    return fd;
+  if ((fd = search_path(runpath, name, hash, path)) >= 0)
+    return fd;
+  if ((fd = search_path(conf_path, name, hash, path)) >= 0)
+    return fd;
+  return search_path(default_path, name, hash, path);
+}
@@ -0,0 +1,150 @@
+#include "private.h"
+
+/*
+ * LD_DEBUG=statistics prints where startup went, on stderr, just before the
+ * program's entry point is called. Phases are timed with the TSC, which is
+ * cheap enough to read around every object, and converted to nanoseconds by
+ * comparing it with CLOCK_MONOTONIC over the whole of startup.
+ *
+ * LD_DEBUG is a comma separated list, as elsewhere; only "statistics" means
+ * anything here. It is ignored for setuid/setgid programs.
+ */
+
+#define OUT_MAX 0x2000
+
+int _dl_stats_enabled;
+struct dl_stats _dl_stats;
+
+static unsigned long long start_tsc, start_ns;
+
+static const struct {
+  const char *name;
+  // nested under the phase before it
+  bool nested;
+} phases[DL_PHASES] = {
+    {"setup", false},
+    {"ld.so.conf", true},
+    {"loading", false},
+    {"searching", true},
+    {"mapping", true},
+    {"static tls", false},
+    {"relocation", false},
+    {"initializers", false},
+};
+
+static char out[OUT_MAX];
+static size_t out_len;
+
+static void put(const char *s) {
+  while (*s != 0 && out_len < OUT_MAX)
+    out[out_len++] = *s++;
+}
+
+// a number right aligned in width columns
+static void put_num(unsigned long long n, size_t width) {
+  char digits[20];
+  size_t len = 0;
+  do
+    digits[len++] = '0' + n % 10;
+  while ((n /= 10) != 0);
+
+  for (; width > len; width--)
+    put(" ");
+  while (len != 0) {
+    char c[2] = {digits[--len], 0};
+    put(c);
+  }
+}
+
+// a label padded to the column numbers start at
+static void put_label(const char *s, size_t indent) {
+  size_t len = indent + strlen(s);
+  for (; indent != 0; indent--)
+    put(" ");
+  put(s);
+  for (; len < 24; len++)
+    put(" ");
+}
+
+static unsigned long long monotonic_ns() {
+  struct __kernel_timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// enables statistics if asked to; tsc is when _dlmain() started
+extern "C" void _dl_stats_init(unsigned long long tsc) {
+  const char *env = _dl_getenv("LD_DEBUG");
+  if (env == 0 || _getauxval(AT_SECURE) ||
+      _dl_list_find(env, "statistics", 10) == 0)
+    return;
+
+  _dl_stats_enabled = 1;
+  start_ns = monotonic_ns();
+  start_tsc = tsc;
+}
+
+extern "C" void _dl_stats_print() {
+  unsigned long long tsc = dl_rdtsc();
+  unsigned long long ns = monotonic_ns() - start_ns;
+  unsigned long long ticks = tsc - start_tsc;
+  if (ticks == 0)
+    ticks = 1;
+
+  put("ld-elf.so: startup statistics\n");
+  put_label("total", 2);
+  put_num(ns, 12);
+  put(" ns\n");
+
+  for (int i = 0; i < DL_PHASES; i++) {
+    put_label(phases[i].name, phases[i].nested ? 4 : 2);
+    put_num(_dl_stats.phase[i] * ns / ticks, 12);
+    put(" ns\n");
+
+    if (i != DL_PHASE_RELOC)
+      continue;
+    for (struct link_map *lm = _dl_head; lm != 0; lm = lm->l_next) {
+      dl_object *obj = (dl_object *)lm;
+      put_label(obj->map.l_name[0] != 0 ? obj->map.l_name : "(program)", 4);
+      put_num(obj->reloc_time * ns / ticks, 12);
+      put(" ns ");
+      put_num(obj->relacount + obj->jmprelcount, 8);
+      put(" relocations\n");
+    }
+  }
+
+  put("  files: ");
+  put_num(_dl_stats.maps, 0);
+  put(" mapped, ");
+  put_num(_dl_stats.opens, 0);
+  put(" opened while searching, ");
+  put_num(_dl_stats.failed_opens, 0);
+  put(" failed, ");
+  put_num(_dl_stats.dirs_skipped, 0);
+  put(" directories skipped\n");
+
+  put("  symbol lookups: ");
+  put_num(_dl_stats.lookups, 0);
+  put(", ");
+  put_num(_dl_stats.objects_searched, 0);
+  put(" objects searched, ");
+  put_num(_dl_stats.bloom_rejects, 0);
+  put(" bloom filter rejections, ");
+  put_num(_dl_stats.chain_entries, 0);
+  put(" hash chain entries, ");
+  put_num(_dl_stats.bind_hits, 0);
+  put(" bind cache hits, ");
+  put_num(_dl_stats.direct_hits, 0);
+  put(" direct bindings\n");
+
+  put("  arena: ");
+  put_num(_dl_arena_stats.mmaps, 0);
+  put(" mappings, ");
+  put_num(_dl_arena_stats.reserved, 0);
+  put(" bytes reserved, ");
+  put_num(_dl_arena_stats.used, 0);
+  put(" in use\n");
+
+  write(2, out, out_len);
+  out_len = 0;
+}
@@ -0,0 +1,74 @@
+#include "private.h"
+
+/*
+ * The dynamic linker can't use libc, so it carries the handful of string
+ * routines it needs. These are kept simple, as they only ever see short names
+ * and paths. memcpy and memset must also exist since the compiler may emit
+ * calls to them for struct copies and initialization.
+ */
+
+int strcmp(const char *a, const char *b) {
+  for (; *a == *b; a++, b++)
+    if (*a == 0)
+      return 0;
+  return (unsigned char)*a - (unsigned char)*b;
+}
+
+int strncmp(const char *a, const char *b, size_t n) {
+  for (; n != 0; a++, b++, n--) {
+    if (*a != *b)
+      return (unsigned char)*a - (unsigned char)*b;
+    if (*a == 0)
+      return 0;
+  }
+  return 0;
+}
+
+/*
+ * libc's are used instead of those it builds too, strlen, memcpy and memset,
+ * when it is linked in; see the makefile and lib/libc/string/makefile.inc.
+ */
+#ifndef RTLD_LIBC
+size_t strlen(const char *s) {
+  const char *p = s;
+  while (*p)
+    p++;
+  return p - s;
+}
+
+void *memcpy(void *restrict dst, const void *restrict src, size_t n) {
+  char *d = dst;
+  const char *s = src;
+  while (n--)
+    *d++ = *s++;
+  return dst;
+}
+
+void *memset(void *dst, int c, size_t n) {
+  char *d = dst;
+  while (n--)
+    *d++ = c;
+  return dst;
+}
+#endif
+
+// finds the entry of a comma separated list, like LD_PROFILE, that is name
+const char *_dl_list_find(const char *list, const char *name, size_t len) {
+  for (const char *entry = list, *p = list;; p++) {
+    if (*p == ',' || *p == 0) {
+      if ((size_t)(p - entry) == len && strncmp(entry, name, len) == 0)
+        return entry;
+      entry = p + 1;
+    }
+    if (*p == 0)
+      return 0;
+  }
+}
+
+// parses a decimal number, stopping at the first non-digit
+unsigned long _dl_atoul(const char *s) {
+  unsigned long n = 0;
+  for (; *s >= '0' && *s <= '9'; s++)
+    n = n * 10 + (*s - '0');
+  return n;
+}
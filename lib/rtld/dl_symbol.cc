@@ -0,0 +1,207 @@
+#include "private.h"
+
+// versym bit marking a symbol version that default lookups must not see
+#define VERSYM_HIDDEN 0x8000
+// sysv_hash hasn't been computed yet, real hashes only use 28 bits
+#define SYSV_HASH_UNSET 0xffffffff
+
+int _dl_direct = 1;
+
+// the SysV ELF hash, for objects that only have DT_HASH
+static uint32_t sysv_hash(const char *name) {
+  uint32_t h = 0;
+  for (; *name; name++) {
+    h = (h << 4) + (unsigned char)*name;
+    uint32_t g = h & 0xf0000000;
+    if (g != 0)
+      h ^= g >> 24;
+    h &= ~g;
+  }
+  return h;
+}
+
+static bool
+matches(const dl_object *obj, size_t index, const char *name) {
+  const Elf64_Sym *sym = &obj->symtab[index];
+  if (sym->st_shndx == SHN_UNDEF)
+    return false;
+
+  switch (ELF64_ST_TYPE(sym->st_info)) {
+  case STT_NOTYPE:
+  case STT_OBJECT:
+  case STT_FUNC:
+  case STT_COMMON:
+  case STT_TLS:
+  case STT_GNU_IFUNC:
+    break;
+  default:
+    return false;
+  }
+
+  switch (ELF64_ST_BIND(sym->st_info)) {
+  case STB_GLOBAL:
+  case STB_WEAK:
+  case STB_GNU_UNIQUE:
+    break;
+  default:
+    return false;
+  }
+
+  if (obj->versym != 0 && (obj->versym[index] & VERSYM_HIDDEN))
+    return false;
+
+  return strcmp(obj->strtab + sym->st_name, name) == 0;
+}
+
+/*
+ * Looks a symbol up in this object alone. name_hash is the GNU hash of name;
+ * the SysV hash is only computed, and then kept in *sysv, when an object
+ * without DT_GNU_HASH is reached.
+ */
+const Elf64_Sym *dl_object::lookup(
+    const char *name, uint32_t name_hash, uint32_t *sysv) const {
+  if (this->gnu_buckets != 0) {
+    // the bloom filter rejects most misses without touching the chains
+    Elf64_Addr word =
+        this->gnu_bloom[(name_hash / 64) % this->gnu_bloom_size];
+    Elf64_Addr mask = (1UL << (name_hash % 64)) |
+                      (1UL << ((name_hash >> this->gnu_bloom_shift) % 64));
+    if ((word & mask) != mask) {
+      dl_stats_count(&_dl_stats.bloom_rejects, 1);
+      return 0;
+    }
+
+    uint32_t i = this->gnu_buckets[name_hash % this->gnu_nbuckets];
+    if (i < this->gnu_symoffset)
+      return 0;
+
+    // chain entries are the hash with the low bit marking the chain's end
+    for (uint32_t first = i;; i++) {
+      uint32_t h = this->gnu_chain[i];
+      if ((h | 1) == (name_hash | 1) && matches(this, i, name)) {
+        dl_stats_count(&_dl_stats.chain_entries, i - first + 1);
+        return &this->symtab[i];
+      }
+      if (h & 1) {
+        dl_stats_count(&_dl_stats.chain_entries, i - first + 1);
+        return 0;
+      }
+    }
+  }
+
+  if (this->hash != 0) {
+    if (*sysv == SYSV_HASH_UNSET)
+      *sysv = sysv_hash(name);
+
+    uint32_t nbucket = this->hash[0];
+    const Elf64_Word *bucket = this->hash + 2;
+    const Elf64_Word *chain = bucket + nbucket;
+    for (uint32_t i = bucket[*sysv % nbucket]; i != STN_UNDEF; i = chain[i]) {
+      dl_stats_count(&_dl_stats.chain_entries, 1);
+      if (matches(this, i, name))
+        return &this->symtab[i];
+    }
+  }
+
+  return 0;
+}
+
+// looks a symbol up in global objects, from lm to the end of the chain
+static const Elf64_Sym *lookup_global(
+    const char *name, struct link_map *lm, const dl_object *skip,
+    dl_object **def) {
+  uint32_t name_hash = dl_gnu_hash(name);
+  uint32_t sysv = SYSV_HASH_UNSET;
+  dl_stats_count(&_dl_stats.lookups, 1);
+
+  for (; lm != 0; lm = lm->l_next) {
+    dl_object *obj = (dl_object *)lm;
+    if (obj == skip || !(obj->flags & DL_OBJ_GLOBAL))
+      continue;
+
+    dl_stats_count(&_dl_stats.objects_searched, 1);
+    const Elf64_Sym *sym = obj->lookup(name, name_hash, &sysv);
+    if (sym != 0) {
+      *def = obj;
+      return sym;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Looks a symbol up in the global scope, which is everything loaded at startup
+ * and by dlopen(RTLD_GLOBAL), in load order, optionally skipping one object
+ * (COPY relocations must not find the copy). The defining object is stored in
+ * *def.
+ */
+extern "C" const Elf64_Sym *
+_dl_lookup(const char *name, const dl_object *skip, dl_object **def) {
+  return lookup_global(name, _dl_head, skip, def);
+}
+
+// looks a symbol up in the global objects loaded after one, for RTLD_NEXT
+extern "C" const Elf64_Sym *
+_dl_lookup_next(const char *name, const dl_object *after, dl_object **def) {
+  return lookup_global(name, after->map.l_next, 0, def);
+}
+
+/*
+ * Follows a direct binding: DT_SYMINFO may record, for a symbol index, which
+ * DT_NEEDED entry (by dynamic section index) or the object itself defines it,
+ * so only that object need be searched. Returns 0 when there is none, or when
+ * that object doesn't define the symbol after all, for a search of the whole
+ * scope instead. Direct bindings bypass interposition, so LD_NODIRECT turns
+ * them off.
+ */
+extern "C" const Elf64_Sym *_dl_lookup_direct(
+    const char *name, const dl_object *obj, uint32_t index, dl_object **def) {
+  if (obj->syminfo == 0 || index >= obj->syminfo_count || !_dl_direct)
+    return 0;
+
+  const Elf64_Syminfo *info = &obj->syminfo[index];
+  if (!(info->si_flags & SYMINFO_FLG_DIRECT))
+    return 0;
+
+  dl_object *target;
+  if (info->si_boundto == SYMINFO_BT_SELF)
+    target = (dl_object *)obj;
+  else if (info->si_boundto < obj->bound_count)
+    target = obj->bound[info->si_boundto];
+  else
+    return 0;
+  if (target == 0)
+    return 0;
+
+  uint32_t sysv = SYSV_HASH_UNSET;
+  const Elf64_Sym *sym = target->lookup(name, dl_gnu_hash(name), &sysv);
+  if (sym != 0) {
+    dl_stats_count(&_dl_stats.direct_hits, 1);
+    *def = target;
+  }
+  return sym;
+}
+
+/*
+ * Looks a symbol up in an object and its dependencies, breadth first, which is
+ * the scope of a dlopen() handle and the local scope of the objects it loaded.
+ * Only called with the loader lock held.
+ */
+extern "C" const Elf64_Sym *
+_dl_lookup_tree(const char *name, dl_object *root, dl_object **def) {
+  uint32_t name_hash = dl_gnu_hash(name);
+  uint32_t sysv = SYSV_HASH_UNSET;
+  dl_stats_count(&_dl_stats.lookups, 1);
+
+  for (dl_object *obj = root->scope(); obj != 0; obj = obj->scope_next) {
+    dl_stats_count(&_dl_stats.objects_searched, 1);
+    const Elf64_Sym *sym = obj->lookup(name, name_hash, &sysv);
+    if (sym != 0) {
+      *def = obj;
+      return sym;
+    }
+  }
+
+  return 0;
+}
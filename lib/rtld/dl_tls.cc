@@ -0,0 +1,335 @@
+#include "private.h"
+
+/*
+ * Thread-local storage, in the x86_64 layout: the thread pointer points at the
+ * TCB, with the static TLS area right below it.
+ *
+ * Every object with PT_TLS at startup gets a block in the static area, at a
+ * fixed distance from the thread pointer, so initial-exec code and TLSDESC
+ * relocations against it never look anything up at run time. Objects loaded by
+ * dlopen() get a module id and, in each thread, a block allocated the first
+ * time that thread touches it.
+ *
+ * Each thread's dtv maps module ids to its blocks, and records the generation
+ * it was brought up to date at. dlopen() and dlclose() bump the generation
+ * whenever they add or remove a module, so __tls_get_addr() and the TLSDESC
+ * resolver compare two words and load the block, and only take the loader lock
+ * when the dtv is stale or the block hasn't been allocated yet. Only its own
+ * thread ever changes a dtv.
+ *
+ * Threads other than the first get their TCB from _rtld_allocate_tls(), and
+ * call _rtld_init_thread() once it is their thread pointer.
+ *
+ * Each TCB holds its thread's struct rseq, which the thread registers with the
+ * kernel itself, so sched_getcpu() is a load and libc's per-CPU helpers work;
+ * see sys/rseq.h. If registration fails, cpu_id says so and libc falls back.
+ */
+
+#define ARCH_SET_FS 0x1002
+// module ids every dtv has room for at first
+#define DTV_MIN 16
+
+struct dl_tls_module {
+  dl_object *obj;
+  // the generation the id was last given out or freed at
+  unsigned long gen;
+};
+
+// a TLSDESC argument, for a block outside the static area
+struct dl_tlsdesc {
+  dl_tls_index index;
+  dl_tlsdesc *next;
+};
+
+unsigned long _dl_tls_generation;
+
+// indexed by module id, from 1
+static dl_tls_module *modules;
+static size_t modules_size, max_modid;
+// the static area, and the alignment of the thread pointer, which the TCB's
+// struct rseq needs to be 32
+static size_t static_size, static_align = 32;
+
+static unsigned long assign_modid(dl_object *obj, unsigned long gen) {
+  size_t id = 1;
+  while (id <= max_modid && modules[id].obj != 0)
+    id++;
+
+  if (id >= modules_size) {
+    size_t size = modules_size != 0 ? modules_size * 2 : DTV_MIN;
+    dl_tls_module *table =
+        (dl_tls_module *)_dl_alloc(size * sizeof(dl_tls_module));
+    if (modules != 0) {
+      memcpy(table, modules, modules_size * sizeof(dl_tls_module));
+      _dl_free(modules, modules_size * sizeof(dl_tls_module));
+    }
+    modules = table;
+    modules_size = size;
+  }
+
+  if (id > max_modid)
+    max_modid = id;
+  modules[id].obj = obj;
+  modules[id].gen = gen;
+  obj->tls_modid = id;
+  return id;
+}
+
+static union dl_dtv *new_dtv(size_t count) {
+  union dl_dtv *dtv = (union dl_dtv *)_dl_alloc((count + 1) * sizeof(dl_dtv));
+  dtv[0].head.count = count;
+  return dtv;
+}
+
+static void free_block(union dl_dtv *entry) {
+  if (entry->mod.raw != 0)
+    _dl_free(entry->mod.raw, entry->mod.size);
+  entry->mod.block = 0;
+  entry->mod.raw = 0;
+  entry->mod.size = 0;
+}
+
+// copies every static block's image into a thread's
+static void copy_images(dl_tcb *tcb) {
+  for (size_t id = 1; id <= max_modid; id++) {
+    dl_object *obj = modules[id].obj;
+    if (obj == 0 || !(obj->flags & DL_OBJ_STATIC_TLS))
+      continue;
+
+    // the rest of the block is .tbss, already zeroed
+    char *block = (char *)tcb - obj->tls_offset;
+    memcpy(block, obj->tls_image, obj->tls_filesz);
+    tcb->dtv[id].mod.block = block;
+  }
+}
+
+// a TCB with a copy of every static block, and a dtv up to date
+static dl_tcb *allocate_tls() {
+  // room to align the thread pointer, with the static area below it
+  size_t size = static_size + static_align + sizeof(dl_tcb);
+  char *area = (char *)_dl_alloc(size);
+  uintptr_t tp = ((uintptr_t)area + static_size + static_align - 1) &
+                 ~(uintptr_t)(static_align - 1);
+
+  dl_tcb *tcb = (dl_tcb *)tp;
+  tcb->self = tcb;
+  tcb->area = area;
+  tcb->area_size = size;
+  tcb->dtv = new_dtv(max_modid > DTV_MIN ? max_modid : DTV_MIN);
+  tcb->dtv[0].head.gen = _dl_tls_generation;
+  tcb->rseq.cpu_id = RSEQ_CPU_ID_UNINITIALIZED;
+  copy_images(tcb);
+  return tcb;
+}
+
+// registers this thread's struct rseq, which the kernel then keeps current
+static void register_rseq(dl_tcb *tcb) {
+  long ret = rseq(&tcb->rseq, sizeof(tcb->rseq), 0, RSEQ_SIG);
+  if (ret < 0)
+    tcb->rseq.cpu_id = RSEQ_CPU_ID_REGISTRATION_FAILED;
+}
+
+/*
+ * Lays out the static area for every object loaded at startup, then gives the
+ * main thread its TCB. Called before relocation, which needs the offsets, so
+ * the blocks are copied again by _dl_tls_relocated().
+ */
+extern "C" void _dl_tls_init() {
+  for (struct link_map *lm = _dl_head; lm != 0; lm = lm->l_next) {
+    dl_object *obj = (dl_object *)lm;
+    if (obj->tls_align == 0)
+      continue;
+
+    assign_modid(obj, 0);
+    size_t align = obj->tls_align;
+    static_size = (static_size + obj->tls_memsz + align - 1) & ~(align - 1);
+    obj->tls_offset = static_size;
+    obj->flags |= DL_OBJ_STATIC_TLS;
+    if (align > static_align)
+      static_align = align;
+  }
+  static_size = (static_size + static_align - 1) & ~(static_align - 1);
+
+  dl_tcb *tcb = allocate_tls();
+  // the low byte stays zero, so string functions can't leak the canary
+  const unsigned long *random = (const unsigned long *)_getauxval(AT_RANDOM);
+  if (random != 0)
+    tcb->stack_guard = *random & ~0xffUL;
+
+  long ret = arch_prctl(ARCH_SET_FS, tcb);
+  if (ret < 0)
+    _dl_fatal("cannot set the thread pointer", 0);
+  register_rseq(tcb);
+}
+
+/*
+ * Copies the static blocks into the main thread's again once everything is
+ * relocated, as .tdata can take relocations itself (__thread void *p = &x).
+ * Threads created from here on copy the relocated images to begin with.
+ */
+extern "C" void _dl_tls_relocated() {
+  copy_images(dl_tcb_self());
+}
+
+// gives new objects from first on that have PT_TLS a module id
+extern "C" void _dl_tls_load(struct link_map *first) {
+  unsigned long gen = _dl_tls_generation + 1;
+  bool added = false;
+  for (struct link_map *lm = first; lm != 0; lm = lm->l_next) {
+    dl_object *obj = (dl_object *)lm;
+    if (obj->tls_align == 0 || obj->tls_modid != 0)
+      continue;
+    assign_modid(obj, gen);
+    added = true;
+  }
+
+  // a reused id may still have an old block in some dtv, which this drops
+  if (added)
+    __atomic_store_n(&_dl_tls_generation, gen, __ATOMIC_RELEASE);
+}
+
+// frees an object's module id and TLSDESC arguments, as it is unloaded
+extern "C" void _dl_tls_unload(dl_object *obj) {
+  for (dl_tlsdesc *desc = obj->tlsdesc, *next; desc != 0; desc = next) {
+    next = desc->next;
+    _dl_free(desc, sizeof(dl_tlsdesc));
+  }
+  obj->tlsdesc = 0;
+
+  unsigned long id = obj->tls_modid;
+  if (id == 0)
+    return;
+
+  // blocks threads allocated for it are freed as their dtvs catch up
+  unsigned long gen = _dl_tls_generation + 1;
+  modules[id].obj = 0;
+  modules[id].gen = gen;
+  obj->tls_modid = 0;
+  __atomic_store_n(&_dl_tls_generation, gen, __ATOMIC_RELEASE);
+}
+
+/*
+ * Fills in a TLSDESC relocation: static blocks are a constant offset from the
+ * thread pointer, and others go through the dtv.
+ */
+extern "C" void _dl_tls_desc(
+    dl_object *obj, const dl_object *def, unsigned long offset,
+    unsigned long *where) {
+  if (def->flags & DL_OBJ_STATIC_TLS) {
+    where[0] = (unsigned long)_dl_tlsdesc_static;
+    where[1] = offset - def->tls_offset;
+    return;
+  }
+
+  dl_tlsdesc *desc = (dl_tlsdesc *)_dl_alloc(sizeof(dl_tlsdesc));
+  desc->index.module = def->tls_modid;
+  desc->index.offset = offset;
+  desc->next = obj->tlsdesc;
+  obj->tlsdesc = desc;
+
+  where[0] = (unsigned long)_dl_tlsdesc_dynamic;
+  where[1] = (unsigned long)desc;
+}
+
+// brings this thread's dtv up to date, dropping blocks of unloaded modules
+static void update_dtv(dl_tcb *tcb) {
+  union dl_dtv *dtv = tcb->dtv;
+  if (dtv[0].head.gen == _dl_tls_generation)
+    return;
+
+  size_t count = dtv[0].head.count;
+  if (count < max_modid) {
+    size_t size = count * 2 > max_modid ? count * 2 : max_modid;
+    union dl_dtv *grown = new_dtv(size);
+    grown[0].head.gen = dtv[0].head.gen;
+    memcpy(grown + 1, dtv + 1, count * sizeof(dl_dtv));
+    _dl_free(dtv, (count + 1) * sizeof(dl_dtv));
+    tcb->dtv = dtv = grown;
+  }
+
+  for (size_t id = 1; id <= max_modid; id++)
+    if (modules[id].gen > dtv[0].head.gen)
+      free_block(&dtv[id]);
+  dtv[0].head.gen = _dl_tls_generation;
+}
+
+// the address of a TLS variable in this thread, with the loader lock held
+extern "C" void *_dl_tls_addr(const dl_tls_index *index) {
+  dl_tcb *tcb = dl_tcb_self();
+  update_dtv(tcb);
+
+  union dl_dtv *entry = &tcb->dtv[index->module];
+  if (entry->mod.block == 0) {
+    dl_object *obj = modules[index->module].obj;
+    size_t align = obj->tls_align;
+    // the arena aligns to 16 bytes, anything more needs slack
+    size_t size = obj->tls_memsz + (align > 16 ? align : 0);
+    char *raw = (char *)_dl_alloc(size);
+    char *block =
+        (char *)(((uintptr_t)raw + align - 1) & ~(uintptr_t)(align - 1));
+    memcpy(block, obj->tls_image, obj->tls_filesz);
+
+    entry->mod.block = block;
+    entry->mod.raw = raw;
+    entry->mod.size = size;
+  }
+
+  return entry->mod.block + index->offset;
+}
+
+// __tls_get_addr() and the TLSDESC resolver's slow path
+extern "C" void *_dl_tls_get_addr(const dl_tls_index *index) {
+  _dl_lock();
+  void *addr = _dl_tls_addr(index);
+  _dl_unlock();
+  return addr;
+}
+
+// this thread's block for a module, if it has one and its dtv is up to date
+extern "C" void *_dl_tls_current(unsigned long module) {
+  union dl_dtv *dtv = dl_tcb_self()->dtv;
+  unsigned long gen = __atomic_load_n(&_dl_tls_generation, __ATOMIC_ACQUIRE);
+  if (dtv[0].head.gen != gen)
+    return 0;
+  return dtv[module].mod.block;
+}
+
+extern "C" __protected void *__tls_get_addr(dl_tls_index *index) {
+  union dl_dtv *dtv = dl_tcb_self()->dtv;
+  if (__builtin_expect(
+          dtv[0].head.gen ==
+              __atomic_load_n(&_dl_tls_generation, __ATOMIC_ACQUIRE),
+          1)) {
+    char *block = dtv[index->module].mod.block;
+    if (block != 0)
+      return block + index->offset;
+  }
+  return _dl_tls_get_addr(index);
+}
+
+// a TCB for a new thread, to become its thread pointer
+extern "C" __protected void *_rtld_allocate_tls() {
+  _dl_lock();
+  dl_tcb *tcb = allocate_tls();
+  tcb->stack_guard = dl_tcb_self()->stack_guard;
+  _dl_unlock();
+  return tcb;
+}
+
+// sets up a new thread, from the thread, once its TCB is its thread pointer
+extern "C" __protected void _rtld_init_thread() {
+  register_rseq(dl_tcb_self());
+}
+
+// frees a TCB from _rtld_allocate_tls(), once its thread has exited
+extern "C" __protected void _rtld_free_tls(void *tp) {
+  dl_tcb *tcb = (dl_tcb *)tp;
+  _dl_profile_free(tcb);
+  _dl_lock();
+  size_t count = tcb->dtv[0].head.count;
+  for (size_t id = 1; id <= count; id++)
+    free_block(&tcb->dtv[id]);
+  _dl_free(tcb->dtv, (count + 1) * sizeof(dl_dtv));
+  _dl_free(tcb->area, tcb->area_size);
+  _dl_unlock();
+}
@@ -0,0 +1,327 @@
+// for RTLD_DEFAULT, RTLD_NEXT and dlinfo()
+#define __BSD_VISIBLE 1
+#include <dlfcn.h>
+#include <sys/cdefs.h>
+
+#include "private.h"
+
+/*
+ * Handles are the dl_objects themselves. They are reference counted, counting
+ * both dlopen() calls and the objects that depend on them, so a library that
+ * is opened twice is loaded once, and is only unloaded once nothing uses it.
+ *
+ * Every handle remembers what dlsym() found through it, so looking the same
+ * name up again is one hash probe. A handle's scope can't change while it is
+ * open, and nothing in it can be unloaded, so these never go stale. The global
+ * scope (RTLD_DEFAULT, or dlopen(NULL)) shares the executable's memo, which is
+ * dropped whenever dlclose() unloads anything. Misses aren't remembered, since
+ * a later dlopen() may define the name.
+ *
+ * All of these hold the loader lock, which also covers the arena and the
+ * registry once the program is running. It is recursive, as initializers and
+ * finalizers run with it held and may call back in. dlerror() is not per
+ * thread.
+ */
+
+#define MEMO_MIN 64
+#define ERROR_MAX 256
+
+void **_dl_catch;
+
+static int loader_lock;
+// the TCB of the thread holding the lock, and how many times it has taken it
+static dl_tcb *lock_owner;
+static unsigned long lock_depth;
+static char error_buf[ERROR_MAX];
+static char *error;
+
+static size_t error_append(size_t len, const char *s) {
+  while (*s != 0 && len < ERROR_MAX - 1)
+    error_buf[len++] = *s++;
+  return len;
+}
+
+// leaves "msg: arg" for dlerror()
+extern "C" void _dl_set_error(const char *msg, const char *arg) {
+  size_t len = error_append(0, msg);
+  if (arg != 0) {
+    len = error_append(len, ": ");
+    len = error_append(len, arg);
+  }
+  error_buf[len] = 0;
+  error = error_buf;
+}
+
+// 0 when unlocked, 1 when locked, 2 when there may also be waiters
+extern "C" void _dl_lock() {
+  // only the owner can find itself here
+  dl_tcb *self = dl_tcb_self();
+  if (__atomic_load_n(&lock_owner, __ATOMIC_RELAXED) == self) {
+    lock_depth++;
+    return;
+  }
+
+  int c = 0;
+  if (!__atomic_compare_exchange_n(
+          &loader_lock, &c, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    if (c != 2)
+      c = __atomic_exchange_n(&loader_lock, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+      futex(&loader_lock, FUTEX_WAIT_PRIVATE, 2, 0);
+      c = __atomic_exchange_n(&loader_lock, 2, __ATOMIC_ACQUIRE);
+    }
+  }
+  __atomic_store_n(&lock_owner, self, __ATOMIC_RELAXED);
+  lock_depth = 1;
+}
+
+extern "C" void _dl_unlock() {
+  if (--lock_depth != 0)
+    return;
+  __atomic_store_n(&lock_owner, (dl_tcb *)0, __ATOMIC_RELAXED);
+  if (__atomic_exchange_n(&loader_lock, 0, __ATOMIC_RELEASE) == 2)
+    futex(&loader_lock, FUTEX_WAKE_PRIVATE, 1, 0);
+}
+
+static dl_object *executable() {
+  return (dl_object *)_dl_head;
+}
+
+static bool valid(void *handle) {
+  for (struct link_map *lm = _dl_head; lm != 0; lm = lm->l_next)
+    if (lm == handle)
+      return true;
+  _dl_set_error("invalid handle", 0);
+  return false;
+}
+
+static void *memo_find(const dl_object *obj, const char *name, uint32_t hash) {
+  if (obj->memo == 0)
+    return 0;
+
+  for (uint32_t i = hash & obj->memo_mask; obj->memo[i].name != 0;
+       i = (i + 1) & obj->memo_mask) {
+    const dl_sym_memo *m = &obj->memo[i];
+    if (m->hash == hash && strcmp(m->name, name) == 0)
+      return m->addr;
+  }
+  return 0;
+}
+
+static void memo_insert(dl_sym_memo *table, uint32_t mask, dl_sym_memo *m) {
+  uint32_t i = m->hash & mask;
+  while (table[i].name != 0)
+    i = (i + 1) & mask;
+  table[i] = *m;
+}
+
+static void memo_add(dl_object *obj, dl_sym_memo *m) {
+  if (obj->memo == 0 || (obj->memo_count + 1) * 2 > obj->memo_mask + 1) {
+    uint32_t size = obj->memo != 0 ? (obj->memo_mask + 1) * 2 : MEMO_MIN;
+    dl_sym_memo *table = (dl_sym_memo *)_dl_alloc(size * sizeof(dl_sym_memo));
+    if (obj->memo != 0) {
+      for (uint32_t i = 0; i <= obj->memo_mask; i++)
+        if (obj->memo[i].name != 0)
+          memo_insert(table, size - 1, &obj->memo[i]);
+      _dl_free(obj->memo, (obj->memo_mask + 1) * sizeof(dl_sym_memo));
+    }
+    obj->memo = table;
+    obj->memo_mask = size - 1;
+  }
+
+  memo_insert(obj->memo, obj->memo_mask, m);
+  obj->memo_count++;
+}
+
+static void memo_clear(dl_object *obj) {
+  if (obj->memo != 0)
+    _dl_free(obj->memo, (obj->memo_mask + 1) * sizeof(dl_sym_memo));
+  obj->memo = 0;
+  obj->memo_mask = obj->memo_count = 0;
+}
+
+// the address a symbol lookup found, or 0 with an error left for dlerror()
+static void *address(const Elf64_Sym *sym, dl_object *def, const char *name) {
+  if (sym == 0) {
+    _dl_set_error("undefined symbol", name);
+    return 0;
+  }
+
+  unsigned long value = def->map.l_base + sym->st_value;
+  switch (ELF64_ST_TYPE(sym->st_info)) {
+  case STT_TLS: {
+    // the calling thread's copy
+    dl_tls_index index = {def->tls_modid, sym->st_value};
+    return _dl_tls_addr(&index);
+  }
+  case STT_GNU_IFUNC:
+    return (void *)((unsigned long (*)(void))value)();
+  }
+  return (void *)value;
+}
+
+/*
+ * Loads a library and its dependencies, unless it is already loaded. Everything
+ * is relocated immediately, so RTLD_LAZY is treated as RTLD_NOW.
+ */
+static dl_object *load(const char *file, int mode) {
+  dl_object *obj;
+  if (mode & RTLD_NOLOAD) {
+    obj = _dl_find_name(file);
+    if (obj == 0)
+      _dl_fatal("not loaded", file);
+  } else {
+    struct link_map *tail = _dl_tail;
+    obj = dl_object::load(file, 0);
+
+    // the same breadth first walk as at startup, over just the new objects
+    for (struct link_map *lm = tail->l_next; lm != 0; lm = lm->l_next) {
+      dl_object *dep = (dl_object *)lm;
+      dep->parse_dynamic();
+      dep->load_needed(false);
+    }
+    _dl_tls_load(tail->l_next);
+    _dl_relocate_all(0);
+    if (_dl_tail != tail)
+      _dl_phdr_publish();
+  }
+
+  obj->refcount++;
+  if (mode & RTLD_NODELETE)
+    obj->flags |= DL_OBJ_NODELETE;
+  if (mode & RTLD_GLOBAL)
+    for (dl_object *dep = obj->scope(); dep != 0; dep = dep->scope_next)
+      dep->flags |= DL_OBJ_GLOBAL;
+  return obj;
+}
+
+extern "C" __protected void *dlopen(const char *file, int mode) {
+  if (file == 0)
+    return executable();
+
+  _dl_lock();
+  if ((mode & (RTLD_LAZY | RTLD_NOW)) == 0) {
+    _dl_set_error("invalid mode", 0);
+    _dl_unlock();
+    return 0;
+  }
+
+  _r_debug.r_state = r_debug::RT_ADD;
+  _dl_debug_state();
+
+  // any error while loading comes back here through _dl_fatal
+  struct link_map *tail = _dl_tail;
+  dl_object *obj = 0;
+  void *env[5];
+  if (__builtin_setjmp(env) == 0) {
+    _dl_catch = env;
+    obj = load(file, mode);
+  } else {
+    _dl_rollback(tail);
+  }
+  _dl_catch = 0;
+
+  _r_debug.r_state = r_debug::RT_CONSISTENT;
+  _dl_debug_state();
+  if (obj != 0)
+    _dl_init_all();
+  _dl_unlock();
+  return obj;
+}
+
+extern "C" __protected int dlclose(void *handle) {
+  _dl_lock();
+  if (!valid(handle)) {
+    _dl_unlock();
+    return -1;
+  }
+
+  dl_object *obj = (dl_object *)handle;
+  if (!(obj->flags & DL_OBJ_NODELETE)) {
+    bool last = obj->refcount == 1;
+    if (last) {
+      _r_debug.r_state = r_debug::RT_DELETE;
+      _dl_debug_state();
+    }
+
+    obj->release();
+
+    if (last) {
+      memo_clear(executable());
+      _r_debug.r_state = r_debug::RT_CONSISTENT;
+      _dl_debug_state();
+    }
+  }
+
+  _dl_unlock();
+  return 0;
+}
+
+extern "C" __protected char *dlerror(void) {
+  char *e = error;
+  error = 0;
+  return e;
+}
+
+/*
+ * Looks a symbol up in a handle's object and its dependencies, breadth first,
+ * or in the global scope for RTLD_DEFAULT and the executable's handle, or for
+ * RTLD_NEXT in the global objects loaded after the caller.
+ */
+extern "C" __protected void *
+dlsym(void *__restrict handle, const char *__restrict name) {
+  unsigned long caller = (unsigned long)__builtin_return_address(0);
+  const Elf64_Sym *sym;
+  dl_object *def;
+  void *addr;
+
+  _dl_lock();
+  if (handle == RTLD_NEXT) {
+    dl_object *obj = dl_object::containing(caller);
+    sym = obj != 0 ? _dl_lookup_next(name, obj, &def) : 0;
+    addr = address(sym, def, name);
+  } else if (handle != RTLD_DEFAULT && !valid(handle)) {
+    addr = 0;
+  } else {
+    dl_object *obj =
+        handle == RTLD_DEFAULT ? executable() : (dl_object *)handle;
+    uint32_t hash = dl_gnu_hash(name);
+    addr = memo_find(obj, name, hash);
+    if (addr == 0) {
+      if (obj == executable())
+        sym = _dl_lookup(name, 0, &def);
+      else
+        sym = _dl_lookup_tree(name, obj, &def);
+
+      // TLS addresses differ between threads, so aren't remembered
+      addr = address(sym, def, name);
+      if (addr != 0 && ELF64_ST_TYPE(sym->st_info) != STT_TLS) {
+        dl_sym_memo m = {hash, def->strtab + sym->st_name, addr};
+        memo_add(obj, &m);
+      }
+    }
+  }
+  _dl_unlock();
+
+  return addr;
+}
+
+extern "C" __protected int
+dlinfo(void *__restrict handle, int request, void *__restrict p) {
+  int ret = -1;
+
+  _dl_lock();
+  if (valid(handle)) {
+    switch (request) {
+    case RTLD_DI_LINKMAP:
+      *(struct link_map **)p = &((dl_object *)handle)->map;
+      ret = 0;
+      break;
+    default:
+      _dl_set_error("unsupported dlinfo request", 0);
+    }
+  }
+  _dl_unlock();
+
+  return ret;
+}
@@ -4,21 +4,58 @@
 
 static char *ld_conf;
 
-void parse_ld_conf() {
-  int Ld_conf_fd = open("/etc/ld.so.conf", 0 /* O_RDONLY */, 0);
-  expect(Ld_conf_fd);
+static int is_separator(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == ':' || c == ',';
+}
+
+/*
+ * Reads /etc/ld.so.conf into a list of search directories. The file stays
+ * mapped, since the directory list points into it rather than copying names.
+ *
+ * `include` directives are not supported and are skipped.
+ */
+struct dl_search_path *parse_ld_conf() {
+  struct dl_search_path *dirs = 0;
+
+  // a missing ld.so.conf just means there are no extra directories
+  int ld_conf_fd = open("/etc/ld.so.conf", O_RDONLY | O_CLOEXEC, 0);
+  if (ld_conf_fd < 0)
+    return 0;
 
   struct stat statbuf;
-  int ret = fstat(Ld_conf_fd, &statbuf);
+  int ret = fstat(ld_conf_fd, &statbuf);
   expect(ret);
+  if (statbuf.st_size == 0) {
+    close(ld_conf_fd);
+    return 0;
+  }
 
-  size_t pagesz = _getauvxal(AT_PAGESZ);
-  size_t mapsz = (statbuf.st_size + pagesz - 1) & ~(pagesz - 1);
-
-  ld_conf = (char *)mmap(0, mapsz, PROT_READ, MAP_PRIVATE, Ld_conf_fd, 0);
+  ld_conf = (char *)mmap(
+      0, statbuf.st_size, PROT_READ, MAP_PRIVATE, ld_conf_fd, 0);
   expect((uintptr_t)ld_conf);
+  close(ld_conf_fd);
 
-  ret = read(Ld_conf_fd, ld_conf, statbuf.st_size);
-  expect(ret);
-  close(Ld_conf_fd);
+  struct dl_search_path **tail = &dirs;
+  const char *p = ld_conf, *end = ld_conf + statbuf.st_size;
+  while (p < end) {
+    if (is_separator(*p)) {
+      p++;
+      continue;
+    }
+
+    // comments and directives run to the end of the line
+    if (*p == '#' || (end - p > 8 && strncmp(p, "include", 7) == 0 &&
+                      (p[7] == ' ' || p[7] == '\t'))) {
+      while (p < end && *p != '\n')
+        p++;
+      continue;
+    }
+
+    const char *dir = p;
+    while (p < end && !is_separator(*p) && *p != '#')
+      p++;
+    tail = _dl_search_path_add(tail, dir, p - dir);
+  }
+
+  return dirs;
 }
@@ -1,103 +1,247 @@
 #include <elf.h>
+#include <errno.h>
 #include <link.h>
 #include <stdint.h>
 #include <sys/cdefs.h>
+#include <sys/rseq.h>
 #include <sys/syscall.h>
-// for mmap flags
+// for open and mmap flags
+#include <linux/fcntl.h>
 #include <linux/mman.h>
+// for clone3 and futex
+#include <linux/futex.h>
+#include <linux/sched.h>
+// for clock_gettime
+#include <linux/time.h>
+#include <linux/rseq.h>
 
 __BEGIN_DECLS
 long _syscall(long, ...);
-#define exit(e) _syscall(SYS_exit, e)
+// exit_group, so a fatal error on a helper thread still ends the process
+#define exit(e) _syscall(SYS_exit_group, e)
 #define mmap(addr, len, prot, flags, fd, offset) \
   _syscall(SYS_mmap, addr, len, prot, flags, fd, offset)
 #define open(path, flag, mode) _syscall(SYS_open, path, flag, mode)
 #define read(fd, buf, len) _syscall(SYS_read, fd, buf, len)
 #define close(fd) _syscall(SYS_close, fd)
 #define fstat(fd, buf) _syscall(SYS_fstat, fd, buf)
+#define stat(path, buf) _syscall(SYS_stat, path, buf)
+#define rename(old, new) _syscall(SYS_rename, old, new)
+#define unlink(path) _syscall(SYS_unlink, path)
+#define getpid() _syscall(SYS_getpid)
+#define write(fd, buf, len) _syscall(SYS_write, fd, buf, len)
+#define pread(fd, buf, len, off) _syscall(SYS_pread64, fd, buf, len, off)
+#define getdents64(fd, buf, len) _syscall(SYS_getdents64, fd, buf, len)
+#define mprotect(addr, len, prot) _syscall(SYS_mprotect, addr, len, prot)
+#define munmap(addr, len) _syscall(SYS_munmap, addr, len)
+#define madvise(addr, len, advice) _syscall(SYS_madvise, addr, len, advice)
+#define readahead(fd, off, len) _syscall(SYS_readahead, fd, off, len)
+#define sched_yield() _syscall(SYS_sched_yield)
+#define arch_prctl(code, addr) _syscall(SYS_arch_prctl, code, addr)
+#define futex(addr, op, val, timeout) \
+  _syscall(SYS_futex, addr, op, val, timeout)
+#define sched_getaffinity(pid, len, mask) \
+  _syscall(SYS_sched_getaffinity, pid, len, mask)
+#define clock_gettime(clock, ts) _syscall(SYS_clock_gettime, clock, ts)
+#define ftruncate(fd, len) _syscall(SYS_ftruncate, fd, len)
+#define rseq(area, len, flags, sig) _syscall(SYS_rseq, area, len, flags, sig)
 
-void _dlmain(Elf64_auxv_t *);
-void parse_ld_conf(void);
-unsigned long _getauvxal(unsigned long);
+// longest path rtld will build for open()
+#define DL_PATH_MAX 4096
+// most program headers rtld will read from an object that doesn't fit them
+// in its first page
+#define DL_MAX_PHDR 64
 
-extern Elf64_auxv_t *_auxv;
-__END_DECLS
+struct dl_object;
+struct dl_search_path;
+struct dl_tcb;
 
-// Checks for possible errno and exits if true
-#define expect(var) if (var & -4095) exit(-var);
+// the argument to __tls_get_addr()
+struct dl_tls_index {
+  unsigned long module, offset;
+};
 
-#if TARGET == x86_64
-  #define R_TARGET_RELATIVE R_X86_64_RELATIVE
-#else
-  #error "Unsupported architecture"
-#endif
+void _dlmain(int, char **, Elf64_auxv_t *);
+struct dl_search_path *parse_ld_conf(void);
+unsigned long _getauxval(unsigned long);
+const char *_dl_getenv(const char *);
+__dead2 void _dl_fatal(const char *, const char *);
+// where _dl_fatal unwinds to while dlopen() runs, see dlfcn.cc
+extern void **_dl_catch;
+void _dl_set_error(const char *, const char *);
+void _dl_lock(void);
+void _dl_unlock(void);
 
-#ifdef __cplusplus
-/*
- * Since we don't have malloc in a freestanding environment, this template
- * provides a method for allocating rarely-freed equal size objects.
- *
- * Things like metadata for loaded objects should be allocated with this, since
- * they are many and equally sized.
- */
-template <int object_size> class dl_pool {
-public:
-  void *alloc() {
-    // a null head means it's full
-    if (this->head == 0)
-      expand();
+void _dl_search_init(void);
+struct dl_search_path **
+_dl_search_path_add(struct dl_search_path **, const char *, size_t);
+struct dl_search_path *_dl_search_path_parse(const char *);
+int _dl_search_library(
+    const char *, struct dl_search_path *, struct dl_search_path *, char *);
 
-    pool_free_object *obj = this->head;
-    this->head = obj->next;
+// the hwcaps subdirectories to search, best first, see dl_hwcaps.cc
+#define DL_HWCAPS_MAX 3
+extern const char *_dl_hwcaps[DL_HWCAPS_MAX];
+extern int _dl_hwcaps_count;
+void _dl_hwcaps_init(void);
 
-    return (void *)(obj);
-  }
+void _dl_relocate_all(int);
+void _dl_rollback(struct link_map *);
+void _dl_phdr_publish(void);
+void _dl_phdr_retire(void *, size_t, int);
 
-  void expand() {
-  #define region_size 0x2000
-    uintptr_t region = mmap(
-        // any address, 2 pages, rw, only for this process
-        0, region_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
-        0);
-    // indicative of an error
-    expect(region);
-
-    pool_free_object *head = (pool_free_object *)region;
-    if (this->head == 0)
-      this->head = head;
-    else
-      this->head->next = head;
-    head = (pool_free_object *)((uintptr_t)head + object_size);
-
-    do {
-      pool_free_object *next =
-          (pool_free_object *)((uintptr_t)head + object_size);
-      head->next = next;
-      head = next;
-    } while ((uintptr_t)head < (region + region_size));
-  #undef region_size
-  }
+void _dl_bind_cache_open(void);
+void _dl_bind_cache_close(void);
+int _dl_bind_replay(
+    const struct dl_object *, uint32_t, const Elf64_Sym **,
+    struct dl_object **);
+void _dl_bind_record(
+    struct dl_object *, uint32_t, const Elf64_Sym *, const struct dl_object *);
 
-  void free(void *obj) {
-    pool_free_object *free_obj = (pool_free_object *)obj;
+void _dl_profile_init(void);
+void _dl_profile_setup(struct dl_object *);
+int _dl_profile_bind(struct dl_object *, const Elf64_Rela *, unsigned long);
+void _dl_profile_unload(struct dl_object *);
+void _dl_profile_free(struct dl_tcb *);
+// LD_PROFILE trampolines, see x86_64/_profile.S
+void _dl_profile_plt(void);
+void _dl_profile_return(void);
 
-    free_obj->next = this->head;
-    this->head = free_obj;
-  }
+void _dl_init_start(int, char **, char **);
+void _dl_init_all(void);
+void _dl_fini_object(struct dl_object *);
+void _dl_fini(void);
 
-private:
-  // one-way linked list of free objects
-  struct pool_free_object {
-    pool_free_object *next;
-  };
-  pool_free_object *head;
-
-  // objects must be large enough to store the linked list
-  _Static_assert(
-      object_size >= sizeof(pool_free_object),
-      "Pooled object is larger than linked list");
+void _dl_lazy_init(void);
+int _dl_lazy_wanted(const char *, unsigned long);
+void _dl_lazy_defer(struct dl_object *, const char *);
+void _dl_lazy_prepare(void);
+// the lazy binding trampoline, see x86_64/_lazy.S
+void _dl_lazy_plt(void);
+
+void _dl_tls_init(void);
+void _dl_tls_relocated(void);
+void _dl_tls_load(struct link_map *);
+void _dl_tls_unload(struct dl_object *);
+void _dl_tls_desc(
+    struct dl_object *, const struct dl_object *, unsigned long,
+    unsigned long *);
+void *_dl_tls_addr(const struct dl_tls_index *);
+void *_dl_tls_get_addr(const struct dl_tls_index *);
+void *_dl_tls_current(unsigned long);
+// TLSDESC resolvers, see x86_64/_tlsdesc.S
+unsigned long _dl_tlsdesc_static(void);
+unsigned long _dl_tlsdesc_dynamic(void);
+extern unsigned long _dl_tls_generation;
+
+struct dl_object *_dl_find_name(const char *);
+struct dl_object *_dl_find_file(unsigned long, unsigned long);
+void _dl_register(struct dl_object *);
+void _dl_register_soname(struct dl_object *);
+void _dl_register_name(struct dl_object *, const char *);
+void _dl_unregister(struct dl_object *);
+void _dl_debug_state(void);
+extern struct r_debug _r_debug;
+const Elf64_Sym *
+_dl_lookup(const char *, const struct dl_object *, struct dl_object **);
+const Elf64_Sym *
+_dl_lookup_next(const char *, const struct dl_object *, struct dl_object **);
+const Elf64_Sym *
+_dl_lookup_tree(const char *, struct dl_object *, struct dl_object **);
+const Elf64_Sym *_dl_lookup_direct(
+    const char *, const struct dl_object *, uint32_t, struct dl_object **);
+// runs fn(arg) on a new thread with the given stack, see x86_64/_clone.S
+long _dl_clone(struct clone_args *, size_t, void (*)(void *), void *);
+
+size_t strlen(const char *);
+int strcmp(const char *, const char *);
+int strncmp(const char *, const char *, size_t);
+void *memcpy(void *__restrict, const void *__restrict, size_t);
+void *memset(void *, int, size_t);
+unsigned long _dl_atoul(const char *);
+const char *_dl_list_find(const char *, const char *, size_t);
+
+void *_dl_alloc(size_t);
+void _dl_free(void *, size_t);
+char *_dl_strdup(const char *);
+char *_dl_strndup(const char *, size_t);
+
+// counters for the arena allocator, see dl_arena.cc
+struct dl_arena_stats {
+  unsigned long mmaps;
+  // bytes mapped, and bytes handed out and not freed
+  unsigned long reserved, used;
+};
+extern struct dl_arena_stats _dl_arena_stats;
+
+// startup phases timed by LD_DEBUG=statistics, see dl_stats.cc
+enum {
+  // auxv, environment and search paths
+  DL_PHASE_SETUP,
+  DL_PHASE_CONF,
+  // everything from the executable to the last DT_NEEDED entry
+  DL_PHASE_LOAD,
+  DL_PHASE_SEARCH,
+  DL_PHASE_MAP,
+  DL_PHASE_TLS,
+  DL_PHASE_RELOC,
+  DL_PHASE_INIT,
+  DL_PHASES
+};
+
+// counters for LD_DEBUG=statistics, with times in TSC ticks
+struct dl_stats {
+  unsigned long long phase[DL_PHASES];
+  // open() calls while searching, and directories their cache ruled out
+  unsigned long opens, failed_opens, dirs_skipped;
+  unsigned long maps;
+  // objects searched, and the work each search did
+  unsigned long lookups, objects_searched, bloom_rejects, chain_entries;
+  unsigned long bind_hits, direct_hits;
 };
+extern int _dl_stats_enabled;
+extern struct dl_stats _dl_stats;
+void _dl_stats_init(unsigned long long);
+void _dl_stats_print(void);
+
+extern Elf64_auxv_t *_dl_auxv;
+extern char **_dl_envp;
+__END_DECLS
+
+// Checks for possible errno and exits if true
+#define expect(var) \
+  if ((unsigned long)(var) > -4096UL) \
+    exit(-(long)(var));
+
+/*
+ * The GNU symbol hash (Bernstein's h * 33 + c). Used for DT_GNU_HASH lookups,
+ * and anywhere else rtld needs to hash a name.
+ */
+static inline uint32_t dl_gnu_hash(const char *name) {
+  uint32_t h = 5381;
+  for (; *name; name++)
+    h = (h << 5) + h + (unsigned char)*name;
+  return h;
+}
+
+#if TARGET == x86_64
+  #define EM_TARGET EM_X86_64
+  #define R_TARGET_NONE R_X86_64_NONE
+  #define R_TARGET_64 R_X86_64_64
+  #define R_TARGET_COPY R_X86_64_COPY
+  #define R_TARGET_GLOB_DAT R_X86_64_GLOB_DAT
+  #define R_TARGET_JUMP_SLOT R_X86_64_JUMP_SLOT
+  #define R_TARGET_RELATIVE R_X86_64_RELATIVE
+  #define R_TARGET_IRELATIVE R_X86_64_IRELATIVE
+  #define R_TARGET_DTPMOD64 R_X86_64_DTPMOD64
+  #define R_TARGET_DTPOFF64 R_X86_64_DTPOFF64
+  #define R_TARGET_TPOFF64 R_X86_64_TPOFF64
+  #define R_TARGET_TLSDESC R_X86_64_TLSDESC
+#else
+  #error "Unsupported architecture"
+#endif
 
+#ifdef __cplusplus
 /*
  * Utility iterator class for iterating through ELF binary headers (Phdr, Shdr).
  */
@@ -141,6 +285,22 @@ private:
 };
 #endif /* __cplusplus */
 
+// where a symbol reference resolved, see dl_bindcache.cc
+struct dl_bind {
+  // 1 + the position of the defining object in the link_map chain
+  uint32_t def;
+  // the symbol's index in the defining object's symbol table
+  uint32_t sym;
+};
+
+// a dlsym() result remembered by a handle, see dlfcn.cc
+struct dl_sym_memo {
+  uint32_t hash;
+  // points into the defining object's string table
+  const char *name;
+  void *addr;
+};
+
 /*
  * Struct representing a dynamically loaded "object" (exe, .so). The structure
  * of this is freely modifiable, as it should never be accessed outside the
@@ -150,20 +310,143 @@ struct dl_object {
   struct link_map map;
   struct dl_object_dep *dep;
 
+  const Elf64_Phdr *phdr;
+  size_t phnum;
+  const char *strtab;
+  const char *soname;
+  // identity of the file it was mapped from, 0 if unknown
+  unsigned long dev, ino;
+  // the reservation map_file() made, 0 for images the kernel mapped
+  unsigned long map_start, map_size;
+  // dlopen() handles plus objects depending on this one
+  unsigned long refcount;
+
+  // DT_RPATH/DT_RUNPATH strings, and the directories parsed from them
+  const char *rpath, *runpath;
+  struct dl_search_path *rpath_dirs, *runpath_dirs;
+
+  const Elf64_Sym *symtab;
+  const Elf64_Half *versym;
+  // DT_HASH, only used when there is no DT_GNU_HASH
+  const Elf64_Word *hash;
+  // DT_GNU_HASH, split into its parts
+  uint32_t gnu_nbuckets, gnu_symoffset, gnu_bloom_size, gnu_bloom_shift;
+  const Elf64_Addr *gnu_bloom;
+  const Elf64_Word *gnu_buckets, *gnu_chain;
+
+  const Elf64_Rela *rela, *jmprel;
+  size_t relacount, jmprelcount;
+  const Elf64_Relr *relr;
+  size_t relrcount;
+  // DT_PLTGOT, whose second and third words PLT0 uses for lazy binding
+  unsigned long *pltgot;
+  // DT_SYMINFO, and the objects its direct bindings name by dynamic section
+  // index, see dl_symbol.cc
+  const Elf64_Syminfo *syminfo;
+  size_t syminfo_count;
+  struct dl_object **bound;
+  size_t bound_count;
+  // DT_INIT, DT_FINI and the arrays, see dl_init.cc
+  unsigned long init, fini;
+  const unsigned long *init_array, *fini_array, *preinit_array;
+  size_t init_count, fini_count, preinit_count;
+  // the next object to finalize after this one
+  struct dl_object *fini_next;
+  // page aligned PT_GNU_RELRO range, made read-only after relocation
+  unsigned long relro_start, relro_end;
+
+  // PT_TLS initialization image, and the module id it was given
+  const char *tls_image;
+  size_t tls_filesz, tls_memsz, tls_align;
+  unsigned long tls_modid;
+  // distance below the thread pointer of its block, for static TLS
+  unsigned long tls_offset;
+  // arguments its TLSDESC relocations point at, for dynamic TLS
+  struct dl_tlsdesc *tlsdesc;
+
+  // bindings by symbol index, while LD_BIND_CACHE is in use at startup
+  struct dl_bind *bind;
+  uint32_t bind_count, bind_index;
+
+  unsigned int flags;
+
+  // links an object's dependency tree breadth first, see scope()
+  struct dl_object *scope_next;
+  unsigned long scope_gen;
+
+  // dlsym() results for this handle, an open addressed table
+  struct dl_sym_memo *memo;
+  uint32_t memo_mask, memo_count;
+
+  // TSC ticks spent relocating it, for LD_DEBUG=statistics
+  unsigned long long reloc_time;
+  // call counters and real JUMP_SLOT targets, see dl_profile.cc
+  struct dl_profile *profile;
+  // DT_NEEDED entries not loaded yet, see dl_lazy.cc
+  struct dl_deferred *deferred;
+
 #ifdef __cplusplus
   dl_object() {}
   // new operator does not support quantities greater than 1
   void *operator new(unsigned long);
 
   void add_dependency(dl_object *);
+
+  // creates an object for an image the kernel already mapped (exe, rtld)
+  static dl_object *
+  from_image(unsigned long, const Elf64_Phdr *, size_t, const char *);
+  // maps an ELF file from an open descriptor
+  static dl_object *map_file(int, const char *);
+  // finds or maps the object a DT_NEEDED entry or dlopen() names
+  static dl_object *load(const char *, dl_object *);
+  // finds the object with a segment holding an address
+  static dl_object *containing(unsigned long);
+
+  void parse_dynamic();
+  // loads DT_NEEDED entries, or defers those that can wait if lazy is set
+  void load_needed(bool lazy);
+  void prefetch();
+  void advise_hugepage();
+  dl_object *scope();
+  void release();
+  void destroy();
+
+  const Elf64_Sym *lookup(const char *, uint32_t, uint32_t *) const;
 #endif /* __cplusplus */
 };
 
+// dl_object flags
+#define DL_OBJ_RELOCATED 0x1
+// a symbolic relocation resolved to an IFUNC, see dl_reloc.cc
+#define DL_OBJ_IFUNC_REFS 0x2
+// in the global scope, which every object's symbols are looked up in
+#define DL_OBJ_GLOBAL 0x4
+// never unloaded, like everything loaded at startup
+#define DL_OBJ_NODELETE 0x8
+// in a dl_iterate_phdr() snapshot, see dl_phdr.cc
+#define DL_OBJ_PUBLISHED 0x10
+// its TLS block is in the static area, see dl_tls.cc
+#define DL_OBJ_STATIC_TLS 0x20
+// its initializers have run, or are running, see dl_init.cc
+#define DL_OBJ_INIT 0x40
+
+__BEGIN_DECLS
+// head and tail of the link_map chain, in load order
+extern struct link_map *_dl_head, *_dl_tail;
+// whether to read dependencies ahead of their use
+extern int _dl_prefetch;
+// whether to place and advise large text segments for huge pages
+extern int _dl_hugepage;
+// whether to follow DT_SYMINFO direct bindings
+extern int _dl_direct;
+// objects ever loaded and unloaded, for dl_iterate_phdr()
+extern unsigned long long _dl_adds, _dl_subs;
+__END_DECLS
+
 /*
  * To keep a consistent memory footprint, and preventing the need for resizeable
- * arrays so we can use the dl_pool allocator for dl_objects, object
- * dependencies (i.e. NEEDED objects in the dynamic table) will be tracked via
- * linked list.
+ * arrays, object dependencies (i.e. NEEDED objects in the dynamic table) will
+ * be tracked via linked list.
  *
  * This also permits reuse of dl_objects as dependencies, preventing duplication
  * or weird logic to account for duplicates.
@@ -178,3 +461,80 @@ struct dl_object_dep {
   void *operator new(unsigned long);
 #endif /* __cplusplus */
 };
+
+/*
+ * One entry of a thread's dtv. Entry 0 holds the generation the vector is up
+ * to date with and the number of module ids it has room for, and entry n holds
+ * module n's block. x86_64/_tlsdesc.S depends on this layout.
+ */
+union dl_dtv {
+  struct {
+    unsigned long gen;
+    size_t count;
+  } head;
+  struct {
+    char *block;
+    // the allocation holding block, 0 for blocks in the static area
+    void *raw;
+    size_t size;
+  } mod;
+};
+
+/*
+ * The thread control block the thread pointer points at, with the static TLS
+ * area right below it. The ABI puts the TCB's own address at 0, and compilers
+ * read the stack protector canary from 0x28.
+ */
+struct dl_tcb {
+  struct dl_tcb *self;
+  union dl_dtv *dtv;
+  // the allocation holding the TCB and the static TLS area
+  void *area;
+  size_t area_size;
+  unsigned long reserved;
+  unsigned long stack_guard;
+  // calls being timed for LD_PROFILE, see dl_profile.cc
+  struct dl_profile_stack *profile;
+  // registered by the thread itself; libc reads it at 0x40, see
+  // lib/libc/private/tcb.h
+  struct rseq rseq;
+  // libc's, at 0x60, see lib/libc/sysstat.c
+  void *sysstat;
+  // the thread's errno and locale, which libc reads at 0x68 and 0x70
+  int error;
+  void *locale;
+};
+
+#if TARGET == x86_64
+static inline struct dl_tcb *dl_tcb_self(void) {
+  struct dl_tcb *tcb;
+  __asm__("mov %%fs:0, %0" : "=r"(tcb));
+  return tcb;
+}
+
+static inline unsigned long long dl_rdtsc(void) {
+  unsigned int lo, hi;
+  __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+  return (unsigned long long)hi << 32 | lo;
+}
+#endif
+
+/*
+ * Statistics are only gathered with LD_DEBUG=statistics, so each of these is
+ * one predictable branch otherwise. Counters are shared by relocation helper
+ * threads, hence the atomics.
+ */
+static inline unsigned long long dl_stats_begin(void) {
+  return __builtin_expect(_dl_stats_enabled, 0) ? dl_rdtsc() : 0;
+}
+
+static inline void
+dl_stats_end(unsigned long long *total, unsigned long long start) {
+  if (__builtin_expect(_dl_stats_enabled, 0))
+    __atomic_fetch_add(total, dl_rdtsc() - start, __ATOMIC_RELAXED);
+}
+
+static inline void dl_stats_count(unsigned long *counter, unsigned long n) {
+  if (__builtin_expect(_dl_stats_enabled, 0))
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
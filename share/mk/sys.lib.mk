@@ -23,10 +23,64 @@ LIBSUFFIX?= .so
 
 OBJS= ${SRCS:S/.cc/.o/:S/.c/.o/:S/.S/.o/}
 _OUT= ${LIBNAME}${LIBSUFFIX}
+# PICLIB also archives the objects, for linking into another shared object
+.ifdef PICLIB
+_PIC= ${LIBNAME}_pic.a
+.endif
+# STATICLIB also archives them as ${LIBNAME}.a, for static and static PIE
+# programs; the objects are PIC either way
+.ifdef STATICLIB
+_STATIC= ${LIBNAME}.a
+.endif
+
+# HWCAPS also builds the shared object for each of HWCAPS_LEVELS, as
+# hwcaps/x86-64-v<level>/${_OUT}, to be installed beneath the directory the
+# baseline one goes in; the dynamic linker prefers the best the CPU can run.
+# Assembly is shared with the baseline build. The variants are optimized
+# with HWCAPS_OPT, as CFLAGS asks for no optimization and, without it, the
+# compiler neither vectorizes nor picks the newer instructions -march allows.
+.if defined(HWCAPS) && ${TARGET} == "x86_64"
+HWCAPS_LEVELS?= 2 3 4
+HWCAPS_OPT?= -O2
+.for _L in ${HWCAPS_LEVELS}
+.SUFFIXES: .v${_L}o
+.c.v${_L}o:
+	${CC} ${CFLAGS} ${CFLAGS.${.IMPSRC}} ${HWCAPS_OPT} \
+	    -march=x86-64-v${_L} -c ${.IMPSRC} -o ${.TARGET}
+.cc.v${_L}o:
+	${CC} ${CCFLAGS} ${CCFLAGS.${.IMPSRC}} ${HWCAPS_OPT} \
+	    -march=x86-64-v${_L} -c ${.IMPSRC} -o ${.TARGET}
+
+_HWCAPS_OBJS.${_L}= ${SRCS:M*.c:R:S/$/.v${_L}o/} \
+    ${SRCS:M*.cc:R:S/$/.v${_L}o/} ${SRCS:M*.S:R:S/$/.o/}
+_HWCAPS+= hwcaps/x86-64-v${_L}/${_OUT}
+_HWCAPS_ALL+= ${_HWCAPS_OBJS.${_L}:M*.v${_L}o}
+
+hwcaps/x86-64-v${_L}/${_OUT}: ${_HWCAPS_OBJS.${_L}}
+	mkdir -p ${.TARGET:H}
+	${LD} -shared ${LDFLAGS} -soname ${_OUT} -o ${.TARGET} \
+	    ${_HWCAPS_OBJS.${_L}} ${LDADD}
+.endfor
+.endif
+
+all: ${_OUT} ${_PIC} ${_STATIC} ${_HWCAPS} .PHONY
 
 ${_OUT}: ${OBJS}
-	${LD} -shared -o ${.TARGET} ${OBJS}
+	${LD} -shared ${LDFLAGS} -soname ${_OUT} -o ${.TARGET} ${OBJS} ${LDADD}
+
+.ifdef PICLIB
+${_PIC}: ${OBJS}
+	${AR} rcs ${.TARGET} ${OBJS}
+.endif
 
-_ALL= ${OBJS} ${OBJS:S/.o/.d/} ${_OUT}
+.ifdef STATICLIB
+${_STATIC}: ${OBJS}
+	${AR} rcs ${.TARGET} ${OBJS}
+.endif
+
+_ALL= ${OBJS} ${OBJS:S/.o/.d/} ${_OUT} ${_PIC} ${_STATIC}
+.ifdef _HWCAPS
+_ALL+= ${_HWCAPS_ALL} hwcaps
+.endif
 clean:
 	rm -rf ${_ALL}